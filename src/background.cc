@@ -0,0 +1,56 @@
+/**\file
+   \brief Temporal background as a running quantile over recent frames
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "background.hh"
+#include "steal_pool.hh"
+#include "utils.hh"
+#include <algorithm>
+
+Background::Background(int k, double q)
+: k(k), q(q)
+{
+	if (k<1) error("Background window needs at least one frame");
+	if (!(q>=0 && q<=1)) error("Background quantile out of [0,1]");
+}
+
+void Background::update(uint16_t const * v, bool swap, size_t i0, size_t i1, uint16_t * bg)
+{
+	size_t sz = size_t(w)*h;
+	uint16_t * rs = ring.data()+(n<k ? n : head)*sz; // slot taking the new frame
+	int m = n<k ? n+1 : k; // values of a pixel after the update
+	int j = int(q*(m-1)+.5); // rank of the quantile
+	for (size_t i = i0; i<i1; i++) {
+		uint16_t x = swap ? uint16_t(v[i]<<8|v[i]>>8) : v[i];
+		uint16_t * s = sorted.data()+i*k;
+		// move the hole left by the oldest value, or the end, to where x belongs
+		int p = n<k ? n : int(std::lower_bound(s,s+k,rs[i])-s);
+		for (; p>0 && s[p-1]>x; p--) s[p] = s[p-1];
+		for (; p+1<m && s[p+1]<x; p++) s[p] = s[p+1];
+		s[p] = x;
+		rs[i] = x;
+		bg[i] = s[j];
+	}
+}
+
+void Background::add(uint16_t const * v, bool swap, int w, int h, uint16_t * bg)
+{
+	if (w!=this->w || h!=this->h) {
+		this->w = w;
+		this->h = h;
+		n = 0;
+		head = 0;
+		ring.assign(size_t(k)*w*h,0);
+		sorted.assign(size_t(k)*w*h,0);
+	}
+	size_t sz = size_t(w)*h;
+	if (pool) {
+		size_t nc = 4*pool->size(); // chunks of pixels
+		pool->run(nc,[&](int, size_t c) {
+			update(v,swap,sz*c/nc,sz*(c+1)/nc,bg);
+		});
+	}
+	else update(v,swap,0,sz,bg);
+	if (n<k) n ++;
+	else head = (head+1)%k;
+}
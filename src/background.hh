@@ -0,0 +1,48 @@
+/**\file
+   \brief Temporal background as a running quantile over recent frames
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details For every pixel the raw values of the last K frames are kept
+   twice, in a ring in arrival order and in a sorted array.  A new frame
+   replaces the oldest value of each pixel in the sorted array by one
+   shift of the values in between, so the window is never sorted anew and
+   the quantile is read off directly.  Memory is four bytes per pixel and
+   frame of the window.  Frames must be added in order, from one thread
+   at a time.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class StealPool;
+
+/// Running quantile of raw frames over a window of frames
+class Background
+{
+	int k; ///<frames in the window
+	double q; ///<quantile in [0,1], 0.5 for the median
+	int w = 0; ///<frame width
+	int h = 0; ///<frame height
+	int n = 0; ///<frames in the window so far
+	int head = 0; ///<ring slot of the oldest frame once the window is full
+	std::vector<uint16_t> ring; ///<frames of the window [k][w*h]
+	std::vector<uint16_t> sorted; ///<values of each pixel in increasing order [w*h][k]
+	StealPool * pool = 0; ///<thread pool for updating, serial if null
+	/// Update pixels [i0,i1) with frame v and write their quantiles
+	void update(uint16_t const * v, bool swap, size_t i0, size_t i1, uint16_t * bg);
+public:
+	/// Create empty window
+	Background(
+		int k, ///<frames in the window
+		double q = 0.5 ///<quantile in [0,1]
+	);
+	void set_pool(StealPool * p) {pool = p;} ///<use thread pool for updating
+	/// Add a frame to the window, dropping the oldest if full, and get the quantile
+	void add(
+		uint16_t const * v, ///<[in] raw frame
+		bool swap, ///<whether bytes of v are to be swapped
+		int w, ///<frame width, restarting the window on change
+		int h, ///<frame height, restarting the window on change
+		uint16_t * bg ///<[out] quantile of each pixel over the window, including v
+	);
+};
@@ -0,0 +1,81 @@
+/**\file
+   \brief Inputs, outputs and progress of batch runs over many files
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "batch.hh"
+#include "utils.hh"
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <fcntl.h>
+#include <glob.h>
+#include <unistd.h>
+
+Checkpoint::Checkpoint(std::string const & fn) : fn(fn)
+{
+	if (fn.empty()) return;
+	std::ifstream is(fn);
+	std::string ln;
+	while (std::getline(is,ln)) {
+		std::istringstream ls(ln);
+		Entry e;
+		std::string in;
+		if (!(ls >> e.frames >> e.offset >> e.done) || ls.get()!='\t' || !std::getline(ls,in)) error("Bad line in checkpoint "+fn+": "+ln);
+		es[in] = e;
+	}
+}
+
+void Checkpoint::save() const
+{
+	if (fn.empty()) return;
+	// write aside and rename, so that an interrupted save leaves the old checkpoint
+	std::string tn = fn+".tmp";
+	{
+		std::ofstream os(tn);
+		if (!os) error("Unable to create "+tn);
+		for (auto & i: es) os << i.second.frames << '\t' << i.second.offset << '\t' << i.second.done << '\t' << i.first << '\n';
+		if (!os.flush()) error("Unable to write "+tn);
+	}
+	sync_file(tn);
+	if (std::rename(tn.c_str(),fn.c_str())) error("Unable to rename "+tn+" to "+fn);
+	auto d = fn.rfind('/');
+	sync_file(d==std::string::npos ? "." : d ? fn.substr(0,d) : "/");
+}
+
+void sync_file(std::string const & fn)
+{
+	int fd = open(fn.c_str(),O_RDONLY);
+	if (fd<0) error("Unable to open "+fn);
+	bool ok = !fsync(fd) || errno==EINVAL; // some file systems cannot sync a directory
+	close(fd);
+	if (!ok) error("Unable to sync "+fn);
+}
+
+std::vector<std::string> batch_inputs(std::vector<std::string> const & args, std::string const & list)
+{
+	std::vector<std::string> ps = args; // patterns
+	if (!list.empty()) {
+		std::ifstream is(list);
+		if (!is) error("Unable to open "+list);
+		std::string ln;
+		while (std::getline(is,ln)) if (!ln.empty()) ps.push_back(ln);
+	}
+	std::vector<std::string> r;
+	for (auto & p: ps) {
+		glob_t g;
+		if (glob(p.c_str(),GLOB_NOCHECK,0,&g)) error("Unable to expand "+p);
+		for (size_t i = 0; i<g.gl_pathc; i++) r.push_back(g.gl_pathv[i]);
+		globfree(&g);
+	}
+	return r;
+}
+
+std::string batch_output(std::string const & dir, std::string const & in, bool bin)
+{
+	std::string b = in.substr(in.find_last_of('/')+1); // base name
+	auto d = b.find_last_of('.');
+	if (d!=std::string::npos && d) b.erase(d);
+	return dir+'/'+b+(bin ? ".locn" : ".csv");
+}
@@ -0,0 +1,60 @@
+/**\file
+   \brief Inputs, outputs and progress of batch runs over many files
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details A checkpoint is a text file with a line per input file giving
+   the frames completed, the size of the output holding exactly those
+   frames, whether the file is finished, and the name of the file, all
+   separated by tabs.  It is rewritten aside and renamed into place, so a
+   run stopped at any time leaves either the old or the new checkpoint.
+   The outputs are synced to disk before the checkpoint naming their
+   sizes, and the checkpoint and its directory after the rename, so that
+   this holds across a crash of the system as well.  A resumed run cuts
+   each output back to the recorded size and carries on from the next
+   frame; an output shorter than recorded is an error.
+*/
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Progress of a batch run over input files
+class Checkpoint
+{
+public:
+	/// Progress on an input file
+	struct Entry
+	{
+		unsigned frames = 0; ///<frames completed
+		uint64_t offset = 0; ///<size of the output holding the completed frames
+		bool done = false; ///<all frames completed
+	};
+private:
+	std::string fn; ///<checkpoint file, empty for none
+	std::map<std::string,Entry> es; ///<progress by name of input file
+public:
+	/// Load the checkpoint if the file exists
+	Checkpoint(
+		std::string const & fn ///<checkpoint file, empty to keep none
+	);
+	Entry & operator[](std::string const & in) {return es[in];} ///<\return progress on input in
+	void save() const; ///<write the checkpoint file
+};
+
+/// Write the data of a file or directory through to disk
+extern void sync_file(
+	std::string const & fn ///<name of the file or directory
+);
+
+/// Input files of a batch run, in order
+extern std::vector<std::string> batch_inputs(
+	std::vector<std::string> const & args, ///<names or glob patterns
+	std::string const & list ///<file with a name or pattern per line, empty for none
+);
+
+/// Output file in directory dir for input in, with the extension for the format
+extern std::string batch_output(
+	std::string const & dir, ///<output directory
+	std::string const & in, ///<input file
+	bool bin ///<binary format?
+); ///<\return name of the output file
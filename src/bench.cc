@@ -0,0 +1,473 @@
+/**\file
+   \brief Benchmark of the localization stages
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Synthetic stacks from the Simulator are written as TIFF into
+   memory and taken through each stage in turn: TIFF decoding, calibration, wavelet filter,
+   detection, fitting and output.  Each stage is timed on its own in
+   frames per second, and fitting also in localizations per second and
+   likelihood evaluations per fit.  With --warm, fitting is run again
+   with warm starts from the previous frame, reporting the evaluations
+   saved and the accuracy of that run.  Localizations are matched to the true
+   positions for recall, precision and RMS error.  With --reference, the
+   localizations of a TIFF file are matched in the same way to a table
+   written by ThunderSTORM.  Heap allocations are counted through the
+   global operator new, and those of localizing frames after the first of
+   a run are reported per frame, zero once the workspace has settled.  The
+   results are written as JSON.
+*/
+#include "tiff.hh"
+#include "calib.hh"
+#include "locate.hh"
+#include "locfile.hh"
+#include "simulate.hh"
+#include "steal_pool.hh"
+#include "utils.hh"
+#include "wavelet.hh"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <memory>
+#include <random>
+#include <sstream>
+
+Calibration calib; ///<conversion of raw counts to photons
+double plsz = 80; ///<pixel size in nm
+bool single_precision = false; ///<process images and fit in float instead of double
+bool warm_start = false; ///<also fit with warm starts from the previous frame
+std::atomic<size_t> allocs(0); ///<heap allocations so far, in all threads
+size_t frame_allocs = 0; ///<heap allocations localizing frames after the first of a run
+
+/// Allocate with counting
+void * operator new(size_t n)
+{
+	allocs.fetch_add(1,std::memory_order_relaxed);
+	if (void * p = std::malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void * p) noexcept {std::free(p);} ///<release memory from operator new
+void operator delete(void * p, size_t) noexcept {std::free(p);} ///<release memory from operator new
+
+/// Result of matching localizations to reference positions
+struct Match
+{
+	size_t nl = 0; ///<number of localizations
+	size_t nr = 0; ///<number of reference positions
+	size_t nm = 0; ///<number of matched pairs
+	double se = 0; ///<sum of squared distances of the pairs
+	double dx = 0; ///<sum of x differences of the pairs
+	double dy = 0; ///<sum of y differences of the pairs
+	/// Match positions of one frame, each reference to the nearest free localization within r
+	void add(std::vector<Loc> const & ls, std::vector<Loc> const & rs, double r)
+	{
+		nl += ls.size();
+		nr += rs.size();
+		std::vector<char> used(ls.size());
+		for (auto & q: rs) {
+			size_t b = ls.size();
+			double bd = r*r;
+			for (size_t i = 0; i<ls.size(); i++) {
+				double ex = ls[i].x-q.x;
+				double ey = ls[i].y-q.y;
+				double d = ex*ex+ey*ey;
+				if (!used[i] && d<=bd) {
+					bd = d;
+					b = i;
+				}
+			}
+			if (b==ls.size()) continue;
+			used[b] = 1;
+			nm ++;
+			se += bd;
+			dx += ls[b].x-q.x;
+			dy += ls[b].y-q.y;
+		}
+	}
+	/// Write as JSON members
+	void json(std::ostream & os) const
+	{
+		os << "\"localizations\": " << nl << ", \"reference\": " << nr << ", \"matched\": " << nm;
+		os << ", \"recall\": " << (nr ? double(nm)/nr : 0);
+		os << ", \"precision\": " << (nl ? double(nm)/nl : 0);
+		os << ", \"rms_nm\": " << (nm ? std::sqrt(se/nm) : 0);
+		os << ", \"bias_x_nm\": " << (nm ? dx/nm : 0);
+		os << ", \"bias_y_nm\": " << (nm ? dy/nm : 0);
+	}
+};
+
+/// Seconds since t
+double since(std::chrono::steady_clock::time_point t)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now()-t).count();
+}
+
+/// Rate of n per t seconds, 0 if not timed
+double rate(double n, double t)
+{
+	return t>0 ? n/t : 0;
+}
+
+/// Localize a raw frame, adding stage statistics to st
+/** The buffers are kept from call to call, as a worker of loc1 does. */
+template<typename T>
+std::vector<Loc> localize(uint16_t const * v, bool swap, int w, int h, unsigned icnt, StealPool * pool, Stages * st, double & tc, WarmStart * ws = 0)
+{
+	static FrameWorkspace<T> wk;
+	static std::vector<Particle> ps;
+	size_t a = allocs;
+	T * im = wk.images(w,h);
+	auto t = std::chrono::steady_clock::now();
+	calib.apply(v,swap,w,h,im,im+size_t(w)*h);
+	tc += since(t);
+	process_image(im,im+size_t(w)*h,calib.variance(w,h,wk.var),w,h,wk,ps,pool,st,ws,icnt);
+	if (icnt) frame_allocs += allocs-a;
+	std::vector<Loc> ls;
+	Loc l;
+	for (auto & r: ps) if (to_loc(r,icnt+1,plsz,l)) ls.push_back(l);
+	return ls;
+}
+
+/// Run all stages on a synthetic stack and write the results as a JSON object
+void bench(std::ostream & js, int w, int h, SimParams const & sp, int nf, uint64_t seed, StealPool * pool)
+{
+	// make the stack
+	std::ostringstream ts;
+	std::vector<std::vector<Loc> > truth;
+	{
+		Simulator sim(sp,w,h,seed);
+		TiffWriter tw(ts);
+		std::vector<uint16_t> v;
+		for (int k = 0; k<nf; k++) {
+			truth.push_back(sim.frame(v,k+1));
+			tw.add(v.data(),w,h);
+		}
+	}
+	std::string tif = ts.str();
+	// decode all frames first, so that decoding is timed on its own
+	std::istringstream is(tif);
+	Tiff tf(is);
+	std::vector<std::vector<uint16_t> > raw(nf);
+	std::vector<uint16_t const *> fv(nf);
+	std::vector<bool> sw(nf);
+	auto t = std::chrono::steady_clock::now();
+	tf.start();
+	for (int k = 0; k<nf; k++) {
+		if (!tf.scan(k)) error("Synthetic stack too short");
+		bool b;
+		fv[k] = tf.frame(k,raw[k],&b);
+		sw[k] = b;
+	}
+	double td = since(t);
+	// localize
+	Stages st;
+	double tc = 0;
+	Match m;
+	std::vector<Loc> all;
+	frame_allocs = 0;
+	for (int k = 0; k<nf; k++) {
+		auto ls = single_precision ?
+			localize<float>(fv[k],sw[k],w,h,k,pool,&st,tc) :
+			localize<double>(fv[k],sw[k],w,h,k,pool,&st,tc);
+		m.add(ls,truth[k],plsz);
+		all.insert(all.end(),ls.begin(),ls.end());
+	}
+	// output in both formats
+	double to[2];
+	for (int f = 0; f<2; f++) {
+		std::ostringstream os;
+		t = std::chrono::steady_clock::now();
+		LocWriter out(os,LocFormat(f));
+		for (auto & l: all) out.add(l);
+		out.flush();
+		to[f] = since(t);
+	}
+	double nl = all.size();
+	js << "{\"width\": " << w << ", \"height\": " << h << ", \"density\": " << sp.density;
+	js << ", \"frames\": " << nf << ", \"emitters\": " << m.nr;
+	js << ",\n\t\t \"fps\": {\"decode\": " << rate(nf,td) << ", \"convert\": " << rate(nf,tc);
+	js << ", \"filter\": " << rate(nf,st.filter) << ", \"detect\": " << rate(nf,st.detect) << ", \"fit\": " << rate(nf,st.fit);
+	js << ", \"output_csv\": " << rate(nf,to[0]) << ", \"output_bin\": " << rate(nf,to[1]);
+	js << ", \"total\": " << rate(nf,td+tc+st.filter+st.detect+st.fit+to[0]) << "}";
+	js << ",\n\t\t \"fit\": {\"candidates\": " << st.fits << ", \"locs_per_s\": " << rate(nl,st.fit);
+	js << ", \"evals_per_fit\": " << (st.fits ? double(st.evals)/st.fits : 0);
+	js << ", \"allocs_per_frame\": " << (nf>1 ? double(frame_allocs)/(nf-1) : 0) << "}";
+	js << ",\n\t\t \"accuracy\": {";
+	m.json(js);
+	js << "}";
+	if (warm_start) {
+		Stages sr;
+		Match mw;
+		WarmStart ws;
+		double tw = 0;
+		frame_allocs = 0;
+		for (int k = 0; k<nf; k++) {
+			auto ls = single_precision ?
+				localize<float>(fv[k],sw[k],w,h,k,pool,&sr,tw,&ws) :
+				localize<double>(fv[k],sw[k],w,h,k,pool,&sr,tw,&ws);
+			mw.add(ls,truth[k],plsz);
+		}
+		double ec = st.fits ? double(st.evals)/st.fits : 0;
+		double ew = sr.fits ? double(sr.evals)/sr.fits : 0;
+		js << ",\n\t\t \"warm\": {\"started\": " << sr.warm << ", \"fit_fps\": " << rate(nf,sr.fit);
+		js << ", \"evals_per_fit\": " << ew << ", \"saving\": " << (ec>0 ? 1-ew/ec : 0);
+		js << ", \"allocs_per_frame\": " << (nf>1 ? double(frame_allocs)/(nf-1) : 0) << ",\n\t\t\t";
+		mw.json(js);
+		js << "}";
+	}
+	js << "}";
+}
+
+/// Read frame, x and y from a ThunderSTORM table, grouped by frame
+std::vector<std::vector<Loc> > read_thunderstorm(std::string const & fn)
+{
+	std::ifstream is(fn);
+	if (!is) error("Unable to open "+fn);
+	std::string ln;
+	std::getline(is,ln);
+	int cf = -1; // columns of frame, x and y
+	int cx = -1;
+	int cy = -1;
+	std::istringstream hs(ln);
+	std::string c;
+	for (int i = 0; std::getline(hs,c,','); i++) {
+		if (c=="\"frame\"") cf = i;
+		else if (c=="\"x [nm]\"") cx = i;
+		else if (c=="\"y [nm]\"") cy = i;
+	}
+	if (cf<0 || cx<0 || cy<0) error("Missing frame or position columns in "+fn);
+	std::vector<std::vector<Loc> > r;
+	while (std::getline(is,ln)) {
+		std::istringstream ls(ln);
+		Loc l = {};
+		for (int i = 0; std::getline(ls,c,','); i++) {
+			if (i==cf) l.frame = atoi(c.c_str());
+			else if (i==cx) l.x = atof(c.c_str());
+			else if (i==cy) l.y = atof(c.c_str());
+		}
+		if (!l.frame) continue;
+		if (r.size()<l.frame) r.resize(l.frame);
+		r[l.frame-1].push_back(l);
+	}
+	return r;
+}
+
+/// Localize a TIFF file and write the match to a reference table as a JSON object
+void reference(std::ostream & js, std::string const & tfn, std::string const & rfn, double mr, StealPool * pool)
+{
+	auto ref = read_thunderstorm(rfn);
+	Tiff tf(tfn);
+	tf.start();
+	Stages st;
+	double tc = 0;
+	Match m;
+	std::vector<uint16_t> b;
+	auto t = std::chrono::steady_clock::now();
+	size_t k = 0;
+	for (; auto fi = tf.scan(k); k++) {
+		bool sw;
+		auto v = tf.frame(k,b,&sw);
+		int w = fi->image_width;
+		int h = fi->image_length;
+		auto ls = single_precision ?
+			localize<float>(v,sw,w,h,k,pool,&st,tc) :
+			localize<double>(v,sw,w,h,k,pool,&st,tc);
+		m.add(ls,k<ref.size() ? ref[k] : std::vector<Loc>(),mr);
+	}
+	for (; k<ref.size(); k++) m.add(std::vector<Loc>(),ref[k],mr);
+	js << "{\"tiff\": \"" << tfn << "\", \"table\": \"" << rfn << "\", \"match_nm\": " << mr;
+	js << ", \"seconds\": " << since(t) << ",\n\t\t";
+	m.json(js);
+	js << "}";
+}
+
+/// Parse comma-separated list of numbers
+std::vector<double> parse_list(char const * s)
+{
+	std::vector<double> r;
+	std::istringstream is(s);
+	std::string c;
+	while (std::getline(is,c,',')) r.push_back(atof(c.c_str()));
+	return r;
+}
+
+/// Show usage of the program
+void usage(char const * cmd)
+{
+	msg(0) << "Usage:\n";
+	msg(0) << '\t' << cmd << " [options]\n\n";
+	msg(0) << "Options:\n";
+	msg(0) << "\t-s, --sizes LIST\tcomma-separated sizes of the square frames (default 128,256,512)\n";
+	msg(0) << "\t-d, --densities LIST\temitters on per square micrometer (default 0.2,1)\n";
+	msg(0) << "\t-n, --frames N\tframes per stack (default 20)\n";
+	msg(0) << "\t--seed N\tseed of the random numbers (default 1)\n";
+	msg(0) << "\t-t, --fit-threads N\tfit particles within a frame with N threads\n";
+	msg(0) << "\t--fused\tcompute wavelet filter in one sweep over rolling row buffers\n";
+	msg(0) << "\t-e, --estimator nm|lm|lmb\testimator for fitting (default nm)\n";
+	msg(0) << "\t-r, --radius N\tradius of the fitting window (default 4)\n";
+	msg(0) << "\t--warm\talso fit with warm starts from the previous frame (nm only)\n";
+	msg(0) << "\t--float\tprocess images and fit in single precision\n";
+	msg(0) << "\t--reference CSV\tmatch localizations of the --tiff file to a ThunderSTORM table\n";
+	msg(0) << "\t--tiff FILE\tTIFF file localized for --reference\n";
+	msg(0) << "\t--match NM\tlargest distance of matched positions (default 1 pixel)\n";
+	msg(0) << "\t--offset X|FILE\tcamera offset in ADU of the --tiff file (default 0)\n";
+	msg(0) << "\t--gain X|FILE\tphotons per ADU of the --tiff file (default 3.6)\n";
+	msg(0) << "\t-o, --output FILE\twrite JSON to FILE instead of stdout\n\n";
+}
+
+/// Run the benchmark as the command line says
+int run(int argc, char ** argv)
+{
+	std::vector<double> sizes{128,256,512};
+	std::vector<double> densities{0.2,1};
+	int nf = 20; // frames per stack
+	unsigned long seed = 1;
+	int nft = 1; // number of fitting threads
+	std::string rfn; // reference table
+	std::string tfn; // TIFF file for the reference
+	double mr = 0; // match radius in nm, 0 for a pixel
+	std::string ofn; // output filename
+	option const opts[] = {
+		{"sizes",required_argument,0,'s'},
+		{"densities",required_argument,0,'d'},
+		{"frames",required_argument,0,'n'},
+		{"seed",required_argument,0,'S'},
+		{"fit-threads",required_argument,0,'t'},
+		{"fused",no_argument,0,'F'},
+		{"estimator",required_argument,0,'e'},
+		{"radius",required_argument,0,'r'},
+		{"float",no_argument,0,'f'},
+		{"warm",no_argument,0,'W'},
+		{"reference",required_argument,0,'R'},
+		{"tiff",required_argument,0,'T'},
+		{"match",required_argument,0,'M'},
+		{"offset",required_argument,0,'B'},
+		{"gain",required_argument,0,'G'},
+		{"output",required_argument,0,'o'},
+		{0,0,0,0}
+	};
+	int c;
+	while ((c = getopt_long(argc,argv,"s:d:n:t:e:r:o:",opts,0))!=-1) switch (c) {
+	case 's':
+		sizes = parse_list(optarg);
+		break;
+	case 'd':
+		densities = parse_list(optarg);
+		break;
+	case 'n':
+		nf = std::max(1,atoi(optarg));
+		break;
+	case 'S':
+		seed = strtoul(optarg,0,10);
+		break;
+	case 't':
+		nft = atoi(optarg);
+		break;
+	case 'F':
+		fused_wavelet = true;
+		break;
+	case 'e':
+		if (std::string(optarg)=="nm") estimator = Est_NM;
+		else if (std::string(optarg)=="lm") estimator = Est_LM;
+		else if (std::string(optarg)=="lmb") estimator = Est_LMB;
+		else {
+			msg(0) << "Unknown estimator: " << optarg << '\n';
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'r':
+		fwr = std::max(1,atoi(optarg));
+		break;
+	case 'f':
+		single_precision = true;
+		break;
+	case 'W':
+		warm_start = true;
+		break;
+	case 'R':
+		rfn = optarg;
+		break;
+	case 'T':
+		tfn = optarg;
+		break;
+	case 'M':
+		mr = atof(optarg);
+		break;
+	case 'B':
+		calib.set(Calibration::Cal_Offset,optarg);
+		break;
+	case 'G':
+		calib.set(Calibration::Cal_Gain,optarg);
+		break;
+	case 'o':
+		ofn = optarg;
+		break;
+	default:
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (rfn.empty()!=tfn.empty()) {
+		msg(0) << "Options --reference and --tiff go together!\n";
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (mr<=0) mr = plsz;
+	if (warm_start && estimator!=Est_NM) {
+		warn << "Warm starts apply to the nm estimator only\n";
+		warm_start = false;
+	}
+
+	std::ofstream ofs;
+	if (!ofn.empty()) {
+		ofs.open(ofn);
+		if (!ofs) {
+			msg(0) << "Unable to create " << ofn << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream & js = ofn.empty() ? std::cout : ofs;
+	std::unique_ptr<StealPool> pool;
+	if (nft>1) pool.reset(new StealPool(nft));
+	char const * en[] = {"nm","lm","lmb"};
+	char const * sl[] = {"none","sse2","avx2"};
+	js << "{\"settings\": {\"estimator\": \"" << en[estimator] << "\", \"float\": " << (single_precision ? "true" : "false");
+	js << ", \"radius\": " << fwr << ", \"fused\": " << (fused_wavelet ? "true" : "false");
+	js << ", \"fit_threads\": " << nft << ", \"simd\": \"" << sl[simd_level()] << "\", \"seed\": " << seed << "},\n";
+	if (!rfn.empty()) {
+		js << " \"thunderstorm\": ";
+		reference(js,tfn,rfn,mr,pool.get());
+		js << ",\n";
+	}
+	// synthetic stacks are made with their own calibration
+	SimParams sp;
+	sp.plsz = plsz;
+	sp.margin = fwr+1;
+	calib = Calibration();
+	calib.set(Calibration::Cal_Offset,std::to_string(sp.offset));
+	calib.set(Calibration::Cal_Gain,std::to_string(sp.gain));
+	std::mt19937_64 rng(seed); // seeds of the stacks
+	js << " \"synthetic\": [";
+	char const * sep = "\n\t";
+	for (double z: sizes) for (double d: densities) {
+		js << sep;
+		sp.density = d;
+		bench(js,int(z),int(z),sp,nf,rng(),pool.get());
+		sep = ",\n\t";
+	}
+	js << "\n ]}\n";
+	return 0;
+}
+
+/// Main function for benchmark, reporting errors
+int main(int argc, char ** argv)
+{
+	try {
+		return run(argc,argv);
+	}
+	catch (Error & e) {
+		msg(0) << "Error: " << e.msg << '\n';
+		return EXIT_FAILURE;
+	}
+}
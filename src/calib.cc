@@ -0,0 +1,261 @@
+/**\file
+   \brief Camera calibration of raw frames
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "calib.hh"
+#include "tiff.hh"
+#include "utils.hh"
+#include "wavelet.hh"
+#include <cstdlib>
+#include <fstream>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CALIB_X86
+#endif
+
+namespace {
+
+/// Convert pixels [i0,i1), with parameters indexed by pixel if M or scalar otherwise
+template<bool M, typename T>
+inline void conv_scalar(uint16_t const * in, bool swap, T const * o, T const * g, T const * v, T * f, T * p, size_t i0, size_t i1)
+{
+	for (size_t i = i0; i<i1; i++) {
+		uint16_t r = swap ? uint16_t(in[i]<<8|in[i]>>8) : in[i];
+		size_t j = M ? i : 0;
+		T x = T(r)-o[j];
+		f[i] = x;
+		p[i] = x*g[j]+v[j];
+	}
+}
+
+#ifdef CALIB_X86
+template<bool M> inline __m128 ld_sse2(float const * a) {return M ? _mm_loadu_ps(a) : _mm_set1_ps(*a);}
+template<bool M> inline __m128d ld_sse2(double const * a) {return M ? _mm_loadu_pd(a) : _mm_set1_pd(*a);}
+
+/// Load 8 raw values, swapping bytes if asked
+inline __m128i raw8(uint16_t const * in, bool swap)
+{
+	__m128i r = _mm_loadu_si128(reinterpret_cast<__m128i const *>(in));
+	if (swap) r = _mm_or_si128(_mm_slli_epi16(r,8),_mm_srli_epi16(r,8));
+	return r;
+}
+
+template<bool M>
+void conv_sse2(uint16_t const * in, bool swap, float const * o, float const * g, float const * v, float * f, float * p, size_t n)
+{
+	__m128i const z = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i+8<=n; i += 8) {
+		__m128i r = raw8(in+i,swap);
+		__m128i q[] = {_mm_unpacklo_epi16(r,z),_mm_unpackhi_epi16(r,z)};
+		for (int k = 0; k<2; k++) {
+			size_t j = i+4*k;
+			size_t c = M ? j : 0;
+			__m128 x = _mm_sub_ps(_mm_cvtepi32_ps(q[k]),ld_sse2<M>(o+c));
+			_mm_storeu_ps(f+j,x);
+			_mm_storeu_ps(p+j,_mm_add_ps(_mm_mul_ps(x,ld_sse2<M>(g+c)),ld_sse2<M>(v+c)));
+		}
+	}
+	conv_scalar<M>(in,swap,o,g,v,f,p,i,n);
+}
+
+template<bool M>
+void conv_sse2(uint16_t const * in, bool swap, double const * o, double const * g, double const * v, double * f, double * p, size_t n)
+{
+	__m128i const z = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i+8<=n; i += 8) {
+		__m128i r = raw8(in+i,swap);
+		__m128i lo = _mm_unpacklo_epi16(r,z);
+		__m128i hi = _mm_unpackhi_epi16(r,z);
+		__m128i q[] = {lo,_mm_srli_si128(lo,8),hi,_mm_srli_si128(hi,8)};
+		for (int k = 0; k<4; k++) {
+			size_t j = i+2*k;
+			size_t c = M ? j : 0;
+			__m128d x = _mm_sub_pd(_mm_cvtepi32_pd(q[k]),ld_sse2<M>(o+c));
+			_mm_storeu_pd(f+j,x);
+			_mm_storeu_pd(p+j,_mm_add_pd(_mm_mul_pd(x,ld_sse2<M>(g+c)),ld_sse2<M>(v+c)));
+		}
+	}
+	conv_scalar<M>(in,swap,o,g,v,f,p,i,n);
+}
+
+template<bool M> __attribute__((target("avx2")))
+inline __m256 ld_avx2(float const * a) {return M ? _mm256_loadu_ps(a) : _mm256_set1_ps(*a);}
+template<bool M> __attribute__((target("avx2")))
+inline __m256d ld_avx2(double const * a) {return M ? _mm256_loadu_pd(a) : _mm256_set1_pd(*a);}
+
+template<bool M> __attribute__((target("avx2")))
+void conv_avx2(uint16_t const * in, bool swap, float const * o, float const * g, float const * v, float * f, float * p, size_t n)
+{
+	size_t i = 0;
+	for (; i+8<=n; i += 8) {
+		size_t c = M ? i : 0;
+		__m256 x = _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(raw8(in+i,swap))),ld_avx2<M>(o+c));
+		_mm256_storeu_ps(f+i,x);
+		_mm256_storeu_ps(p+i,_mm256_add_ps(_mm256_mul_ps(x,ld_avx2<M>(g+c)),ld_avx2<M>(v+c)));
+	}
+	conv_scalar<M>(in,swap,o,g,v,f,p,i,n);
+}
+
+template<bool M> __attribute__((target("avx2")))
+void conv_avx2(uint16_t const * in, bool swap, double const * o, double const * g, double const * v, double * f, double * p, size_t n)
+{
+	size_t i = 0;
+	for (; i+8<=n; i += 8) {
+		__m256i r = _mm256_cvtepu16_epi32(raw8(in+i,swap));
+		__m128i q[] = {_mm256_castsi256_si128(r),_mm256_extracti128_si256(r,1)};
+		for (int k = 0; k<2; k++) {
+			size_t j = i+4*k;
+			size_t c = M ? j : 0;
+			__m256d x = _mm256_sub_pd(_mm256_cvtepi32_pd(q[k]),ld_avx2<M>(o+c));
+			_mm256_storeu_pd(f+j,x);
+			_mm256_storeu_pd(p+j,_mm256_add_pd(_mm256_mul_pd(x,ld_avx2<M>(g+c)),ld_avx2<M>(v+c)));
+		}
+	}
+	conv_scalar<M>(in,swap,o,g,v,f,p,i,n);
+}
+#endif
+
+/// Convert n pixels at the selected SIMD level
+template<bool M, typename T>
+void convert(uint16_t const * in, bool swap, T const * o, T const * g, T const * v, T * f, T * p, size_t n)
+{
+	switch (simd_level()) {
+#ifdef CALIB_X86
+	case Simd_AVX2: conv_avx2<M>(in,swap,o,g,v,f,p,n); break;
+	case Simd_SSE2: conv_sse2<M>(in,swap,o,g,v,f,p,n); break;
+#endif
+	default: conv_scalar<M>(in,swap,o,g,v,f,p,0,n);
+	}
+}
+
+/// Read a per-pixel map from a TIFF of 16-bit integers or 32-bit floats or a text file
+std::vector<double> read_map(std::string const & fn, int & w, int & h)
+{
+	std::ifstream is(fn,std::ios::binary);
+	if (!is) error("Unable to open "+fn);
+	char m[2] = {};
+	is.read(m,2);
+	if ((m[0]=='I' && m[1]=='I') || (m[0]=='M' && m[1]=='M')) {
+		is.close();
+		Tiff tf(fn);
+		tf.start();
+		auto fi = tf.scan(0);
+		if (!fi) error("No image in "+fn);
+		w = fi->image_width;
+		h = fi->image_length;
+		return tf.values(0);
+	}
+	// text with one row of the image per line
+	is.seekg(0);
+	std::vector<double> r;
+	std::string ln;
+	w = 0;
+	h = 0;
+	while (std::getline(is,ln)) {
+		char const * s = ln.c_str();
+		char * e;
+		int n = 0;
+		for (double x = strtod(s,&e); e!=s; x = strtod(s,&e)) {
+			r.push_back(x);
+			n ++;
+			s = e;
+			while (*s==',') s ++;
+		}
+		if (!n) continue;
+		if (w && n!=w) error("Rows of different lengths in "+fn);
+		w = n;
+		h ++;
+	}
+	if (r.empty()) error("No values in "+fn);
+	return r;
+}
+
+} // namespace
+
+Calibration::Calibration()
+: sv{0,3.6,0}
+{}
+
+void Calibration::set(Param k, std::string const & s)
+{
+	char * e;
+	double x = strtod(s.c_str(),&e);
+	if (!s.empty() && !*e) {
+		sv[k] = x;
+		md[k].clear();
+	}
+	else {
+		int w;
+		int h;
+		md[k] = read_map(s,w,h);
+		if (mw && (w!=mw || h!=mh)) error("Calibration maps of different sizes");
+		mw = w;
+		mh = h;
+	}
+	bool any = false;
+	for (auto & m: md) if (!m.empty()) any = true;
+	size_t n = any ? size_t(mw)*mh : 0;
+	for (int i = 0; i<3; i++) {
+		if (md[i].empty()) ad[i].assign(n,sv[i]);
+		else ad[i] = md[i];
+		af[i].assign(ad[i].begin(),ad[i].end());
+	}
+}
+
+template<typename T>
+void Calibration::apply(uint16_t const * in, bool swap, int w, int h, T * filt, T * phot) const
+{
+	size_t n = size_t(w)*h;
+	auto m = maps(T());
+	if (m[0].empty()) {
+		T s[] = {T(sv[0]),T(sv[1]),T(sv[2])};
+		convert<false>(in,swap,s,s+1,s+2,filt,phot,n);
+	}
+	else {
+		if (w!=mw || h!=mh) error("Calibration maps do not match image size");
+		convert<true>(in,swap,m[0].data(),m[1].data(),m[2].data(),filt,phot,n);
+	}
+}
+
+template<typename T>
+void Calibration::subtract(uint16_t const * bg, int w, int h, T * filt) const
+{
+	size_t n = size_t(w)*h;
+	auto m = maps(T());
+	if (m[0].empty()) {
+		T o = T(sv[0]);
+		for (size_t i = 0; i<n; i++) filt[i] -= T(bg[i])-o;
+	}
+	else {
+		if (w!=mw || h!=mh) error("Calibration maps do not match image size");
+		T const * o = m[0].data();
+		for (size_t i = 0; i<n; i++) filt[i] -= T(bg[i])-o[i];
+	}
+}
+
+template<typename T>
+T const * Calibration::variance(int w, int h, std::vector<T> & b) const
+{
+	if (md[Cal_Variance].empty() && sv[Cal_Variance]==0) return 0;
+	auto m = maps(T());
+	if (!m[0].empty()) {
+		if (w!=mw || h!=mh) error("Calibration maps do not match image size");
+		return m[Cal_Variance].data();
+	}
+	T v = T(sv[Cal_Variance]);
+	size_t n = size_t(w)*h;
+	if (b.size()!=n || b[0]!=v) b.assign(n,v);
+	return b.data();
+}
+
+///@{
+/// Instantiations for the supported scalar types
+template void Calibration::apply(uint16_t const *, bool, int, int, float *, float *) const;
+template void Calibration::apply(uint16_t const *, bool, int, int, double *, double *) const;
+template void Calibration::subtract(uint16_t const *, int, int, float *) const;
+template void Calibration::subtract(uint16_t const *, int, int, double *) const;
+template float const * Calibration::variance(int, int, std::vector<float> &) const;
+template double const * Calibration::variance(int, int, std::vector<double> &) const;
+///@}
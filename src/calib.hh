@@ -0,0 +1,69 @@
+/**\file
+   \brief Camera calibration of raw frames
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details A raw count r becomes the filter input r-o, in ADU above the
+   offset o, and the photon image (r-o)g+v, with g the gain in photons per
+   ADU and v the readout variance in photons squared.  Adding the variance
+   to the data is the data side of the sCMOS likelihood; the fitters add
+   the same per-pixel variance to the model, so that the model mu+v is
+   compared with the data D+v.  Each parameter is either a
+   scalar or a per-pixel map for sCMOS cameras.  Both images are produced
+   in one pass over the raw frame with byte swapping folded in, through
+   SIMD kernels at the level selected for the wavelet filter, with results
+   independent of the level.
+*/
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Conversion of raw frames with camera offset, gain and readout variance
+class Calibration
+{
+	double sv[3]; ///<scalar values of the parameters
+	std::vector<double> md[3]; ///<per-pixel maps as loaded, empty for scalar
+	int mw = 0; ///<width of the maps
+	int mh = 0; ///<height of the maps
+	std::vector<double> ad[3]; ///<all parameters as maps if any is a map
+	std::vector<float> af[3]; ///<ad in single precision
+	std::vector<double> const * maps(double) const {return ad;}
+	std::vector<float> const * maps(float) const {return af;}
+public:
+	/// Calibration parameters
+	enum Param {
+		Cal_Offset, ///<offset in ADU
+		Cal_Gain, ///<gain in photons per ADU
+		Cal_Variance ///<readout variance in photons squared
+	};
+	Calibration(); ///<offset 0, gain 3.6 and no readout variance
+	/// Set a parameter to a number or to a per-pixel map from a file
+	void set(
+		Param k, ///<parameter to set
+		std::string const & s ///<number, or name of a TIFF of 16-bit integers or 32-bit floats or a text file with a number per pixel
+	);
+	/// Convert a raw frame to filter input and photon image
+	template<typename T>
+	void apply(
+		uint16_t const * in, ///<[in] raw pixel values
+		bool swap, ///<whether bytes of in are to be swapped
+		int w, ///<image width
+		int h, ///<image height
+		T * filt, ///<[out] filter input
+		T * phot ///<[out] photon image
+	) const;
+	/// Take a background in raw counts off the filter input, leaving r-b
+	template<typename T>
+	void subtract(
+		uint16_t const * bg, ///<[in] background in raw counts
+		int w, ///<image width
+		int h, ///<image height
+		T * filt ///<[in,out] filter input
+	) const;
+	/// Readout variance of each pixel, for the model side of the likelihood
+	template<typename T>
+	T const * variance(
+		int w, ///<image width
+		int h, ///<image height
+		std::vector<T> & b ///<[in,out] buffer for a scalar variance, kept between calls
+	) const; ///<\return w by h values, null if there is no readout variance
+};
@@ -0,0 +1,111 @@
+/**\file
+   \brief Decoders for compressed TIFF strips
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "codec.hh"
+#include <cstring>
+#include <zlib.h>
+
+size_t unpack_bits(char const * in, size_t n, char * out, size_t m)
+{
+	size_t i = 0;
+	size_t o = 0;
+	while (i<n && o<m) {
+		int c = static_cast<signed char>(in[i++]);
+		if (c>=0) { // literal run of c+1 bytes
+			size_t l = c+1;
+			if (l>n-i) l = n-i;
+			if (l>m-o) l = m-o;
+			memcpy(out+o,in+i,l);
+			i += l;
+			o += l;
+		}
+		else if (c!=-128 && i<n) { // repeat next byte 1-c times
+			size_t l = 1-c;
+			if (l>m-o) l = m-o;
+			memset(out+o,in[i++],l);
+			o += l;
+		}
+	}
+	return o;
+}
+
+/** Each code stands for a string that already appears in the output, so
+    the table keeps only the position and length of its last appearance. */
+size_t lzw_decode(char const * in, size_t n, char * out, size_t m)
+{
+	int const clear = 256; // code to reset the table
+	int const eoi = 257; // end of information
+	uint32_t pos[4096]; // start of the string of each code in out
+	uint32_t len[4096]; // length of the string of each code
+	for (int c = 0; c<256; c++) len[c] = 1;
+	int next = 258; // next code to be added
+	int width = 9; // current code width
+	int prev = -1; // previous code, -1 right after a clear
+	size_t ps = 0; // start of the string of prev in out
+	uint64_t bits = 0; // bit buffer, most significant bits first
+	int nb = 0; // number of bits in buffer
+	size_t i = 0;
+	size_t o = 0;
+	while (o<m) {
+		while (nb<width && i<n) {
+			bits = bits<<8|uint8_t(in[i++]);
+			nb += 8;
+		}
+		if (nb<width) break; // out of data
+		int c = int(bits>>(nb-width)&((1u<<width)-1));
+		nb -= width;
+		if (c==eoi) break;
+		if (c==clear) {
+			next = 258;
+			width = 9;
+			prev = -1;
+			continue;
+		}
+		size_t s = o; // start of the string of c
+		if (c<256) out[o++] = char(c);
+		else if (c<next) {
+			size_t l = len[c];
+			if (l>m-o) l = m-o;
+			memcpy(out+o,out+pos[c],l);
+			o += l;
+		}
+		else if (c==next && prev>=0) { // string of prev followed by its first byte
+			size_t l = len[prev];
+			if (l>m-o) l = m-o;
+			memcpy(out+o,out+ps,l);
+			o += l;
+			if (o<m) out[o++] = out[s];
+		}
+		else break; // invalid code
+		if (prev>=0 && next<4096) { // string of prev with the first byte of c follows at ps
+			pos[next] = ps;
+			len[next] = len[prev]+1;
+			next ++;
+			if (next>=(1<<width)-1 && width<12) width ++;
+		}
+		prev = c;
+		ps = s;
+	}
+	return o;
+}
+
+size_t inflate_strip(char const * in, size_t n, char * out, size_t m)
+{
+	z_stream z;
+	memset(&z,0,sizeof(z));
+	if (inflateInit(&z)!=Z_OK) return 0;
+	z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+	z.avail_in = n;
+	z.next_out = reinterpret_cast<Bytef *>(out);
+	z.avail_out = m;
+	inflate(&z,Z_FINISH);
+	size_t o = m-z.avail_out;
+	inflateEnd(&z);
+	return o;
+}
+
+void undo_predictor(uint16_t * p, size_t w, size_t h)
+{
+	for (size_t y = 0; y<h; y++, p += w) for (size_t x = 1; x<w; x++) p[x] += p[x-1];
+}
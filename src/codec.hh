@@ -0,0 +1,43 @@
+/**\file
+   \brief Decoders for compressed TIFF strips
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Each decoder expands one strip into a buffer of known size and
+   returns the number of bytes produced, which falls short of the buffer
+   size for truncated or corrupt data.  Nothing is ever written beyond the
+   buffer.  The decoders keep no state between calls, so strips can be
+   decoded concurrently.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// Decode PackBits run-length encoding
+extern size_t unpack_bits(
+	char const * in, ///<[in] compressed data
+	size_t n, ///<size of compressed data
+	char * out, ///<[out] decoded data
+	size_t m ///<size of out
+); ///<\return number of bytes decoded
+
+/// Decode LZW compression as used by TIFF, with codes of 9 to 12 bits
+extern size_t lzw_decode(
+	char const * in, ///<[in] compressed data
+	size_t n, ///<size of compressed data
+	char * out, ///<[out] decoded data
+	size_t m ///<size of out
+); ///<\return number of bytes decoded
+
+/// Decode Deflate (zlib) compression
+extern size_t inflate_strip(
+	char const * in, ///<[in] compressed data
+	size_t n, ///<size of compressed data
+	char * out, ///<[out] decoded data
+	size_t m ///<size of out
+); ///<\return number of bytes decoded
+
+/// Undo horizontal differencing of 16-bit samples in native byte order
+extern void undo_predictor(
+	uint16_t * p, ///<[in,out] samples
+	size_t w, ///<samples per row
+	size_t h ///<number of rows
+);
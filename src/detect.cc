@@ -0,0 +1,144 @@
+/**\file
+   \brief Detection of candidate particles as local maxima
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "detect.hh"
+#include "wavelet.hh"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DETECT_X86
+#endif
+
+namespace {
+
+/// Append maxima above t among pixels [x0,x1) of row c, with rows a above and b below, at positions o+x
+template<typename T>
+inline void row_scalar(T const * a, T const * c, T const * b, T t, int x0, int x1, int o, std::vector<int> & cand)
+{
+	for (int x = x0; x<x1; x++) {
+		T v = c[x];
+		if (!(v>t)) continue;
+		if (
+			v>c[x+1] && v>b[x-1] && v>b[x] && v>b[x+1] &&
+			!(c[x-1]>v) && !(a[x-1]>v) && !(a[x]>v) && !(a[x+1]>v)
+		) cand.push_back(o+x);
+	}
+}
+
+/// Append positions o+i for the lanes i set in mask k
+inline void push_mask(int k, int o, std::vector<int> & cand)
+{
+	for (; k; k &= k-1) cand.push_back(o+__builtin_ctz(k));
+}
+
+#ifdef DETECT_X86
+void row_sse2(float const * a, float const * c, float const * b, float t, int x0, int x1, int o, std::vector<int> & cand)
+{
+	__m128 const vt = _mm_set1_ps(t);
+	int x = x0;
+	for (; x+4<=x1; x += 4) {
+		__m128 v = _mm_loadu_ps(c+x);
+		__m128 m = _mm_cmpgt_ps(v,vt);
+		if (!_mm_movemask_ps(m)) continue;
+		m = _mm_and_ps(m,_mm_cmpgt_ps(v,_mm_loadu_ps(c+x+1)));
+		m = _mm_and_ps(m,_mm_cmpgt_ps(v,_mm_loadu_ps(b+x-1)));
+		m = _mm_and_ps(m,_mm_cmpgt_ps(v,_mm_loadu_ps(b+x)));
+		m = _mm_and_ps(m,_mm_cmpgt_ps(v,_mm_loadu_ps(b+x+1)));
+		__m128 u = _mm_cmpgt_ps(_mm_loadu_ps(c+x-1),v); // some backward neighbour higher
+		u = _mm_or_ps(u,_mm_cmpgt_ps(_mm_loadu_ps(a+x-1),v));
+		u = _mm_or_ps(u,_mm_cmpgt_ps(_mm_loadu_ps(a+x),v));
+		u = _mm_or_ps(u,_mm_cmpgt_ps(_mm_loadu_ps(a+x+1),v));
+		push_mask(_mm_movemask_ps(_mm_andnot_ps(u,m)),o+x,cand);
+	}
+	row_scalar(a,c,b,t,x,x1,o,cand);
+}
+
+void row_sse2(double const * a, double const * c, double const * b, double t, int x0, int x1, int o, std::vector<int> & cand)
+{
+	__m128d const vt = _mm_set1_pd(t);
+	int x = x0;
+	for (; x+2<=x1; x += 2) {
+		__m128d v = _mm_loadu_pd(c+x);
+		__m128d m = _mm_cmpgt_pd(v,vt);
+		if (!_mm_movemask_pd(m)) continue;
+		m = _mm_and_pd(m,_mm_cmpgt_pd(v,_mm_loadu_pd(c+x+1)));
+		m = _mm_and_pd(m,_mm_cmpgt_pd(v,_mm_loadu_pd(b+x-1)));
+		m = _mm_and_pd(m,_mm_cmpgt_pd(v,_mm_loadu_pd(b+x)));
+		m = _mm_and_pd(m,_mm_cmpgt_pd(v,_mm_loadu_pd(b+x+1)));
+		__m128d u = _mm_cmpgt_pd(_mm_loadu_pd(c+x-1),v);
+		u = _mm_or_pd(u,_mm_cmpgt_pd(_mm_loadu_pd(a+x-1),v));
+		u = _mm_or_pd(u,_mm_cmpgt_pd(_mm_loadu_pd(a+x),v));
+		u = _mm_or_pd(u,_mm_cmpgt_pd(_mm_loadu_pd(a+x+1),v));
+		push_mask(_mm_movemask_pd(_mm_andnot_pd(u,m)),o+x,cand);
+	}
+	row_scalar(a,c,b,t,x,x1,o,cand);
+}
+
+__attribute__((target("avx2")))
+void row_avx2(float const * a, float const * c, float const * b, float t, int x0, int x1, int o, std::vector<int> & cand)
+{
+	__m256 const vt = _mm256_set1_ps(t);
+	int x = x0;
+	for (; x+8<=x1; x += 8) {
+		__m256 v = _mm256_loadu_ps(c+x);
+		__m256 m = _mm256_cmp_ps(v,vt,_CMP_GT_OQ);
+		if (!_mm256_movemask_ps(m)) continue;
+		m = _mm256_and_ps(m,_mm256_cmp_ps(v,_mm256_loadu_ps(c+x+1),_CMP_GT_OQ));
+		m = _mm256_and_ps(m,_mm256_cmp_ps(v,_mm256_loadu_ps(b+x-1),_CMP_GT_OQ));
+		m = _mm256_and_ps(m,_mm256_cmp_ps(v,_mm256_loadu_ps(b+x),_CMP_GT_OQ));
+		m = _mm256_and_ps(m,_mm256_cmp_ps(v,_mm256_loadu_ps(b+x+1),_CMP_GT_OQ));
+		__m256 u = _mm256_cmp_ps(_mm256_loadu_ps(c+x-1),v,_CMP_GT_OQ);
+		u = _mm256_or_ps(u,_mm256_cmp_ps(_mm256_loadu_ps(a+x-1),v,_CMP_GT_OQ));
+		u = _mm256_or_ps(u,_mm256_cmp_ps(_mm256_loadu_ps(a+x),v,_CMP_GT_OQ));
+		u = _mm256_or_ps(u,_mm256_cmp_ps(_mm256_loadu_ps(a+x+1),v,_CMP_GT_OQ));
+		push_mask(_mm256_movemask_ps(_mm256_andnot_ps(u,m)),o+x,cand);
+	}
+	row_scalar(a,c,b,t,x,x1,o,cand);
+}
+
+__attribute__((target("avx2")))
+void row_avx2(double const * a, double const * c, double const * b, double t, int x0, int x1, int o, std::vector<int> & cand)
+{
+	__m256d const vt = _mm256_set1_pd(t);
+	int x = x0;
+	for (; x+4<=x1; x += 4) {
+		__m256d v = _mm256_loadu_pd(c+x);
+		__m256d m = _mm256_cmp_pd(v,vt,_CMP_GT_OQ);
+		if (!_mm256_movemask_pd(m)) continue;
+		m = _mm256_and_pd(m,_mm256_cmp_pd(v,_mm256_loadu_pd(c+x+1),_CMP_GT_OQ));
+		m = _mm256_and_pd(m,_mm256_cmp_pd(v,_mm256_loadu_pd(b+x-1),_CMP_GT_OQ));
+		m = _mm256_and_pd(m,_mm256_cmp_pd(v,_mm256_loadu_pd(b+x),_CMP_GT_OQ));
+		m = _mm256_and_pd(m,_mm256_cmp_pd(v,_mm256_loadu_pd(b+x+1),_CMP_GT_OQ));
+		__m256d u = _mm256_cmp_pd(_mm256_loadu_pd(c+x-1),v,_CMP_GT_OQ);
+		u = _mm256_or_pd(u,_mm256_cmp_pd(_mm256_loadu_pd(a+x-1),v,_CMP_GT_OQ));
+		u = _mm256_or_pd(u,_mm256_cmp_pd(_mm256_loadu_pd(a+x),v,_CMP_GT_OQ));
+		u = _mm256_or_pd(u,_mm256_cmp_pd(_mm256_loadu_pd(a+x+1),v,_CMP_GT_OQ));
+		push_mask(_mm256_movemask_pd(_mm256_andnot_pd(u,m)),o+x,cand);
+	}
+	row_scalar(a,c,b,t,x,x1,o,cand);
+}
+#endif
+
+} // namespace
+
+template<typename T>
+void find_maxima(T const * f, int w, int h, int r, T t, std::vector<int> & cand)
+{
+	cand.clear();
+	for (int y = r; y<h-r; y++) {
+		T const * c = f+y*w;
+		switch (simd_level()) {
+#ifdef DETECT_X86
+		case Simd_AVX2: row_avx2(c-w,c,c+w,t,r,w-r,y*w,cand); break;
+		case Simd_SSE2: row_sse2(c-w,c,c+w,t,r,w-r,y*w,cand); break;
+#endif
+		default: row_scalar(c-w,c,c+w,t,r,w-r,y*w,cand);
+		}
+	}
+}
+
+///@{
+/// Instantiations for the supported scalar types
+template void find_maxima(float const *, int, int, int, float, std::vector<int> &);
+template void find_maxima(double const *, int, int, int, double, std::vector<int> &);
+///@}
@@ -0,0 +1,26 @@
+/**\file
+   \brief Detection of candidate particles as local maxima
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Pixels are first compared with the threshold a vector at a
+   time, and blocks with no pixel above it are skipped, so that sparse
+   frames cost little more than one compare per pixel.  In the rest, the
+   eight neighbours are compared as whole vectors and the surviving lanes
+   are read off the packed compare mask.  A pixel is a maximum when it is
+   higher than its neighbours east, south-east, south and south-west, and
+   no lower than the others, which are the outcomes of the forward
+   elimination that used to do this.  The candidates do not depend on the
+   instruction set selected with set_simd_level.
+*/
+#pragma once
+#include <vector>
+
+/// Find 8-connected local maxima above a threshold, away from the border
+template<typename T>
+void find_maxima(
+	T const * f, ///<[in] image
+	int w, ///<image width
+	int h, ///<image height
+	int r, ///<width of the border without candidates, at least 1
+	T t, ///<threshold
+	std::vector<int> & cand ///<[out] positions of the maxima, in increasing order
+);
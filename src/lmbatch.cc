@@ -0,0 +1,252 @@
+/**\file
+   \brief Batched Levenberg--Marquardt fitting of many PSFs at once
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "lmbatch.hh"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+/// Solve the 5-by-5 system a*x = b by elimination with partial pivoting
+template<typename T>
+bool solve(T (* a)[5], T * b)
+{
+	int const n = 5;
+	for (int c = 0; c<n; c++) {
+		int m = c;
+		for (int r = c+1; r<n; r++) if (std::fabs(a[r][c])>std::fabs(a[m][c])) m = r;
+		if (a[m][c]==0) return false;
+		if (m!=c) {
+			for (int k = 0; k<n; k++) std::swap(a[c][k],a[m][k]);
+			std::swap(b[c],b[m]);
+		}
+		for (int r = c+1; r<n; r++) {
+			T f = a[r][c]/a[c][c];
+			for (int k = c; k<n; k++) a[r][k] -= f*a[c][k];
+			b[r] -= f*b[c];
+		}
+	}
+	for (int c = n-1; c>=0; c--) {
+		for (int k = c+1; k<n; k++) b[c] -= a[c][k]*b[k];
+		b[c] /= a[c][c];
+	}
+	return true;
+}
+
+} // namespace
+
+template<typename T>
+LMBatch<T>::LMBatch(int l, int nb) :
+	l(l), nb(nb), im(l*l*nb), vr(l*l*nb), p(5*nb), q(5*nb), dq(5*nb), g(5*nb), f(25*nb), gt(5*nb), ft(25*nb),
+	y(nb), yt(nb), lambda(nb), active(nb), valid(nb), ax(6*l*nb),
+	pe(nb), mu(nb), lm(nb), iter(nb)
+{}
+
+template<typename T>
+int LMBatch<T>::add(T const * sq, int w, vec_t const & p0, T const * vq)
+{
+	int b = n++;
+	for (int y = 0; y<l; y++) for (int x = 0; x<l; x++) {
+		im[(y*l+x)*nb+b] = sq[y*w+x];
+		vr[(y*l+x)*nb+b] = vq ? vq[y*w+x] : 0;
+	}
+	for (int k = 0; k<5; k++) p[k*nb+b] = p0[k];
+	return b;
+}
+
+template<typename T>
+typename LMBatch<T>::vec_t LMBatch<T>::result(int b) const
+{
+	vec_t r;
+	for (int k = 0; k<5; k++) r[k] = p[k*nb+b];
+	return r;
+}
+
+template<typename T>
+void LMBatch<T>::eval(T const * r, T * ly, T * lg, T * lf)
+{
+	// per-axis factors: e, derivative to center, derivative to width; x then y
+	for (int a = 0; a<2; a++) {
+		T const * c = r+a*nb; // center
+		T const * s = r+2*nb; // width
+		T * e = ax.data()+3*a*l*nb;
+		T * dc = e+l*nb;
+		T * ds = dc+l*nb;
+		for (int x = 0; x<l; x++) for (int b = 0; b<n; b++) {
+			T s2s = std::sqrt(T(2))*s[b];
+			T nm = 1/(std::sqrt(T(2*M_PI))*s[b]);
+			T u = x-c[b]-T(.5);
+			T v = x-c[b]+T(.5);
+			T gu = std::exp(-u*u/(2*s[b]*s[b]));
+			T gv = std::exp(-v*v/(2*s[b]*s[b]));
+			int i = x*nb+b;
+			e[i] = (std::erf(v/s2s)-std::erf(u/s2s))*T(.5);
+			dc[i] = nm*(gu-gv);
+			ds[i] = nm*(u*gu-v*gv)/s[b];
+		}
+	}
+	T const * ex = ax.data();
+	T const * dx = ex+l*nb;
+	T const * sx = dx+l*nb;
+	T const * ey = sx+l*nb;
+	T const * dy = ey+l*nb;
+	T const * sy = dy+l*nb;
+	std::fill(ly,ly+n,T(0));
+	std::fill(lg,lg+5*nb,T(0));
+	std::fill(lf,lf+25*nb,T(0));
+	T const * r3 = r+3*nb;
+	T const * r4 = r+4*nb;
+	// lane arrays of the accumulated gradient and lower Fisher information
+	T * g0 = lg;
+	T * g1 = lg+nb;
+	T * g2 = lg+2*nb;
+	T * g3 = lg+3*nb;
+	T * g4 = lg+4*nb;
+	T * f00 = lf;
+	T * f10 = lf+5*nb;
+	T * f11 = lf+6*nb;
+	T * f20 = lf+10*nb;
+	T * f21 = lf+11*nb;
+	T * f22 = lf+12*nb;
+	T * f30 = lf+15*nb;
+	T * f31 = lf+16*nb;
+	T * f32 = lf+17*nb;
+	T * f33 = lf+18*nb;
+	T * f40 = lf+20*nb;
+	T * f41 = lf+21*nb;
+	T * f42 = lf+22*nb;
+	T * f43 = lf+23*nb;
+	T * f44 = lf+24*nb;
+	T * pe = this->pe.data();
+	T * mu = this->mu.data();
+	T * lm = this->lm.data();
+	int const nn = n;
+	for (int yy = 0; yy<l; yy++) for (int xx = 0; xx<l; xx++) {
+		T const * d = im.data()+(yy*l+xx)*nb;
+		T const * v = vr.data()+(yy*l+xx)*nb;
+		T const * ex1 = ex+xx*nb;
+		T const * dx1 = dx+xx*nb;
+		T const * sx1 = sx+xx*nb;
+		T const * ey1 = ey+yy*nb;
+		T const * dy1 = dy+yy*nb;
+		T const * sy1 = sy+yy*nb;
+		// the logarithm is kept out of the lane loops that do the rest,
+		// and lane arrays never overlap
+#pragma GCC ivdep
+		for (int b = 0; b<nn; b++) {
+			pe[b] = ex1[b]*ey1[b];
+			mu[b] = r3[b]*pe[b]+r4[b]+v[b];
+		}
+		for (int b = 0; b<nn; b++) lm[b] = std::log(mu[b]);
+#pragma GCC ivdep
+		for (int b = 0; b<nn; b++) {
+			T m = mu[b];
+			ly[b] += d[b]*lm[b]-m;
+			// derivatives of the model
+			T j0 = r3[b]*dx1[b]*ey1[b];
+			T j1 = r3[b]*ex1[b]*dy1[b];
+			T j2 = r3[b]*(sx1[b]*ey1[b]+ex1[b]*sy1[b]);
+			T j3 = pe[b];
+			T j4 = 1;
+			T rr = 1-d[b]/m;
+			g0[b] += rr*j0;
+			g1[b] += rr*j1;
+			g2[b] += rr*j2;
+			g3[b] += rr*j3;
+			g4[b] += rr*j4;
+			f00[b] += j0*j0/m;
+			f10[b] += j1*j0/m;
+			f11[b] += j1*j1/m;
+			f20[b] += j2*j0/m;
+			f21[b] += j2*j1/m;
+			f22[b] += j2*j2/m;
+			f30[b] += j3*j0/m;
+			f31[b] += j3*j1/m;
+			f32[b] += j3*j2/m;
+			f33[b] += j3*j3/m;
+			f40[b] += j4*j0/m;
+			f41[b] += j4*j1/m;
+			f42[b] += j4*j2/m;
+			f43[b] += j4*j3/m;
+			f44[b] += j4*j4/m;
+		}
+	}
+	for (int b = 0; b<n; b++) {
+		// a model value not positive leaves the sum infinite or undefined
+		ly[b] = std::isfinite(ly[b]) ? -ly[b] : INFINITY;
+		for (int a = 0; a<5; a++) for (int c = 0; c<a; c++) lf[(c*5+a)*nb+b] = lf[(a*5+c)*nb+b];
+	}
+}
+
+template<typename T>
+void LMBatch<T>::fit()
+{
+	eval(p.data(),y.data(),g.data(),f.data());
+	for (int b = 0; b<n; b++) {
+		lambda[b] = 1e-3;
+		active[b] = 1;
+		iter[b] = 0;
+	}
+	int na = n; // number of active lanes
+	while (na) {
+		// propose steps for the active lanes, others stay put
+		for (int b = 0; b<n; b++) {
+			for (int k = 0; k<5; k++) q[k*nb+b] = p[k*nb+b];
+			valid[b] = 0;
+			if (!active[b]) continue;
+			if (iter[b]>=mxiter) {
+				active[b] = 0;
+				continue;
+			}
+			iter[b] ++;
+			T a[5][5];
+			T d[5];
+			for (int r = 0; r<5; r++) {
+				for (int c = 0; c<5; c++) a[r][c] = f[(r*5+c)*nb+b];
+				a[r][r] *= 1+lambda[b];
+				d[r] = -g[r*nb+b];
+			}
+			if (!solve(a,d)) {
+				active[b] = 0;
+				continue;
+			}
+			for (int k = 0; k<5; k++) {
+				dq[k*nb+b] = d[k];
+				q[k*nb+b] += d[k];
+			}
+			valid[b] = q[2*nb+b]>0 && q[3*nb+b]>0 && q[4*nb+b]>=0;
+		}
+		eval(q.data(),yt.data(),gt.data(),ft.data());
+		// accept or reject the steps
+		na = 0;
+		for (int b = 0; b<n; b++) {
+			if (!active[b]) continue;
+			T t = valid[b] ? yt[b] : T(INFINITY);
+			if (t<=y[b]) {
+				bool done = true;
+				for (int k = 0; k<5; k++) {
+					T pk = q[k*nb+b];
+					if (std::fabs(dq[k*nb+b])>tol*std::fmax(T(1),std::fabs(pk))) done = false;
+					p[k*nb+b] = pk;
+					g[k*nb+b] = gt[k*nb+b];
+				}
+				for (int k = 0; k<25; k++) f[k*nb+b] = ft[k*nb+b];
+				y[b] = t;
+				lambda[b] *= T(0.1);
+				if (done) active[b] = 0;
+			}
+			else {
+				lambda[b] *= 10;
+				if (lambda[b]>1e10) active[b] = 0;
+			}
+			if (active[b]) na ++;
+		}
+	}
+}
+
+///@{
+/// Instantiations for the supported scalar types
+template class LMBatch<float>;
+template class LMBatch<double>;
+///@}
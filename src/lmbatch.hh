@@ -0,0 +1,72 @@
+/**\file
+   \brief Batched Levenberg--Marquardt fitting of many PSFs at once
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details A block of subimages is fitted together with the algorithm of
+   LMFit.  Subimages, parameters and intermediate results are kept as
+   structure of arrays with one lane per subimage, so the per-pixel work
+   runs in loops over lanes that the compiler vectorizes.  Lanes that have
+   converged are masked off and keep their results while the others go
+   on.  Each lane performs exactly the arithmetic of LMFit, so the results
+   are identical to fitting the subimages one by one.
+*/
+#pragma once
+#include <array>
+#include <vector>
+
+/// Levenberg--Marquardt fitter for a block of subimages, instantiated for float and double
+template<typename T>
+class LMBatch
+{
+public:
+	typedef std::array<T,5> vec_t; ///<x, y, sigma, photon count, background
+private:
+	int l; ///<lateral size of subimages
+	int nb; ///<number of lanes
+	int n = 0; ///<number of lanes in use
+	int mxiter = 50; ///<maximum number of iterations
+	T tol = 1e-6; ///<relative step size for convergence
+	std::vector<T> im; ///<subimages, lane index fastest
+	std::vector<T> vr; ///<readout variances added to the model, lane index fastest
+	std::vector<T> p; ///<current parameters [5][nb]
+	std::vector<T> q; ///<trial parameters [5][nb]
+	std::vector<T> dq; ///<steps from p to q [5][nb]
+	std::vector<T> g; ///<gradient at p [5][nb]
+	std::vector<T> f; ///<Fisher information at p [5][5][nb]
+	std::vector<T> gt; ///<gradient at q [5][nb]
+	std::vector<T> ft; ///<Fisher information at q [5][5][nb]
+	std::vector<T> y; ///<negative log-likelihood at p
+	std::vector<T> yt; ///<negative log-likelihood at q
+	std::vector<T> lambda; ///<damping of the lanes
+	std::vector<char> active; ///<lane still iterating?
+	std::vector<char> valid; ///<trial parameters in valid region?
+	std::vector<T> ax; ///<per-axis factors and derivatives [6][l][nb]
+	std::vector<T> pe; ///<PSF factor of a pixel for each lane
+	std::vector<T> mu; ///<model value of a pixel for each lane
+	std::vector<T> lm; ///<logarithm of the model value
+	/// Evaluate likelihood, gradient and Fisher information at r for all lanes
+	void eval(
+		T const * r, ///<parameters [5][nb]
+		T * ly, ///<[out] negative log-likelihoods
+		T * lg, ///<[out] gradients [5][nb]
+		T * lf ///<[out] Fisher information [5][5][nb]
+	);
+public:
+	std::vector<int> iter; ///<iterations used by each lane
+	int max_iter() const {return mxiter;} ///<\return maximum number of iterations
+	/// Construct the fitter
+	LMBatch(
+		int l, ///<lateral size of subimages
+		int nb ///<number of lanes
+	);
+	int lanes() const {return nb;} ///<\return number of lanes
+	void clear() {n = 0;} ///<remove all subimages
+	/// Add a subimage to the next free lane
+	int add(
+		T const * sq, ///<corner of the subimage
+		int w, ///<width of the image containing the subimage
+		vec_t const & p0, ///<initial guess
+		T const * vq = 0 ///<corner of the readout variance, null for none
+	); ///<\return lane used
+	void fit(); ///<fit all lanes in use
+	vec_t result(int b) const; ///<\return fitted parameters of lane b
+};
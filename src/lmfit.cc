@@ -0,0 +1,148 @@
+/**\file
+   \brief Levenberg--Marquardt maximum likelihood fitting of PSF
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "lmfit.hh"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+/// Solve the n-by-n system a*x = b by elimination with partial pivoting
+template<typename T>
+bool solve(T (* a)[5], T * b, int n)
+{
+	for (int c = 0; c<n; c++) {
+		int m = c;
+		for (int r = c+1; r<n; r++) if (std::fabs(a[r][c])>std::fabs(a[m][c])) m = r;
+		if (a[m][c]==0) return false;
+		if (m!=c) {
+			for (int k = 0; k<n; k++) std::swap(a[c][k],a[m][k]);
+			std::swap(b[c],b[m]);
+		}
+		for (int r = c+1; r<n; r++) {
+			T f = a[r][c]/a[c][c];
+			for (int k = c; k<n; k++) a[r][k] -= f*a[c][k];
+			b[r] -= f*b[c];
+		}
+	}
+	for (int c = n-1; c>=0; c--) {
+		for (int k = c+1; k<n; k++) b[c] -= a[c][k]*b[k];
+		b[c] /= a[c][c];
+	}
+	return true;
+}
+
+/// Integrated Gaussian along one axis with derivatives to center and width
+template<typename T>
+inline void axis(T * e, T * dc, T * ds, int l, T c, T s)
+{
+	T s2s = std::sqrt(T(2))*s;
+	T nm = 1/(std::sqrt(T(2*M_PI))*s);
+	for (int x = 0; x<l; x++) {
+		T a = x-c-T(.5);
+		T b = x-c+T(.5);
+		T ga = std::exp(-a*a/(2*s*s));
+		T gb = std::exp(-b*b/(2*s*s));
+		e[x] = (std::erf(b/s2s)-std::erf(a/s2s))*T(.5);
+		dc[x] = nm*(ga-gb);
+		ds[x] = nm*(a*ga-b*gb)/s;
+	}
+}
+
+} // namespace
+
+template<typename T, int R>
+LMFit<T,R>::LMFit(int l, int w) : l(R ? 2*R+1 : l), w(w), ex(this->l), ey(this->l), dx(this->l), dy(this->l), sx(this->l), sy(this->l) {}
+
+template<typename T, int R>
+T LMFit<T,R>::eval(vec_t const & p, T * g, T (* f)[5])
+{
+	int const l = R ? 2*R+1 : this->l; // constant for fixed radius
+	cnt ++;
+	axis(ex.data(),dx.data(),sx.data(),l,p[0],p[2]);
+	axis(ey.data(),dy.data(),sy.data(),l,p[1],p[2]);
+	for (int a = 0; a<5; a++) {
+		g[a] = 0;
+		for (int b = 0; b<5; b++) f[a][b] = 0;
+	}
+	T tl = 0;
+	T jm[5]; // derivatives of the model
+	for (int y = 0; y<l; y++) for (int x = 0; x<l; x++) {
+		T e = ex[x]*ey[y];
+		T mu = p[3]*e+p[4];
+		if (v) mu += v[y*w+x];
+		if (!(mu>0)) return INFINITY;
+		T d = i[y*w+x];
+		tl += d*std::log(mu)-mu;
+		jm[0] = p[3]*dx[x]*ey[y];
+		jm[1] = p[3]*ex[x]*dy[y];
+		jm[2] = p[3]*(sx[x]*ey[y]+ex[x]*sy[y]);
+		jm[3] = e;
+		jm[4] = 1;
+		T r = 1-d/mu;
+		for (int a = 0; a<5; a++) {
+			g[a] += r*jm[a];
+			for (int b = 0; b<=a; b++) f[a][b] += jm[a]*jm[b]/mu;
+		}
+	}
+	for (int a = 0; a<5; a++) for (int b = 0; b<a; b++) f[b][a] = f[a][b];
+	return -tl;
+}
+
+template<typename T, int R>
+typename LMFit<T,R>::vec_t LMFit<T,R>::fit(vec_t const & p0)
+{
+	iter = 0;
+	cnt = 0;
+	vec_t p = p0;
+	T g[5], f[5][5]; // at current position
+	T gt[5], ft[5][5]; // at trial position
+	T y = eval(p,g,f);
+	T lambda = 1e-3; // damping
+	while (iter<mxiter) {
+		iter ++;
+		T a[5][5];
+		vec_t d;
+		for (int r = 0; r<5; r++) {
+			for (int c = 0; c<5; c++) a[r][c] = f[r][c];
+			a[r][r] *= 1+lambda;
+			d[r] = -g[r];
+		}
+		if (!solve(a,d.data(),5)) break;
+		vec_t q;
+		for (int k = 0; k<5; k++) q[k] = p[k]+d[k];
+		T yt = q[2]>0 && q[3]>0 && q[4]>=0 ? eval(q,gt,ft) : T(INFINITY);
+		if (yt<=y) { // accept the step
+			p = q;
+			y = yt;
+			for (int r = 0; r<5; r++) {
+				g[r] = gt[r];
+				for (int c = 0; c<5; c++) f[r][c] = ft[r][c];
+			}
+			lambda *= T(0.1);
+			bool done = true;
+			for (int k = 0; k<5; k++) if (std::fabs(d[k])>tol*std::fmax(T(1),std::fabs(p[k]))) done = false;
+			if (done) break;
+		}
+		else { // reject and damp more
+			lambda *= 10;
+			if (lambda>1e10) break;
+		}
+	}
+	return p;
+}
+
+///@{
+/// Instantiations for the supported scalar types and window radii
+template class LMFit<float>;
+template class LMFit<float,3>;
+template class LMFit<float,4>;
+template class LMFit<float,5>;
+template class LMFit<float,6>;
+template class LMFit<double>;
+template class LMFit<double,3>;
+template class LMFit<double,4>;
+template class LMFit<double,5>;
+template class LMFit<double,6>;
+///@}
@@ -0,0 +1,62 @@
+/**\file
+   \brief Levenberg--Marquardt maximum likelihood fitting of PSF
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details The integrated Gaussian PSF is fitted to a square subimage
+   with Poisson statistics, the readout variance of sCMOS pixels, if any,
+   added to the model as it is to the data.  Each iteration uses the analytic gradient of
+   the negative log-likelihood and the Fisher information as Hessian,
+   damped in the manner of Levenberg and Marquardt.  Parameters are fitted
+   directly, not in the square-root form used with Nelder--Mead.  A nonzero
+   window radius R fixes the subimage size at compile time so that the
+   per-pixel loops have constant trip counts.
+*/
+#pragma once
+#include <array>
+#include <vector>
+
+/// Levenberg--Marquardt fitter of integrated Gaussian PSF
+/** Instantiated for float and double with R of 0 (size given at run time)
+    and 3 to 6. */
+template<typename T, int R = 0>
+class LMFit
+{
+public:
+	typedef std::array<T,5> vec_t; ///<x, y, sigma, photon count, background
+private:
+	T const * i; ///<subimage pointer
+	T const * v = 0; ///<readout variance at the subimage, null for none
+	int l; ///<lateral size of subimage, 2R+1 if R is nonzero
+	int w; ///<original image width (for row skip)
+	std::vector<T> ex; ///<x-factors of the PSF
+	std::vector<T> ey; ///<y-factors of the PSF
+	std::vector<T> dx; ///<derivatives of x-factors to x
+	std::vector<T> dy; ///<derivatives of y-factors to y
+	std::vector<T> sx; ///<derivatives of x-factors to sigma
+	std::vector<T> sy; ///<derivatives of y-factors to sigma
+	int mxiter = 50; ///<maximum number of iterations
+	T tol = 1e-6; ///<relative step size for convergence
+	/// Evaluate negative log-likelihood with gradient and Fisher information
+	T eval(
+		vec_t const & p, ///<parameters
+		T * g, ///<[out] gradient
+		T (* f)[5] ///<[out] Fisher information
+	);
+public:
+	int iter; ///<iterations used in last fit
+	int cnt; ///<likelihood evaluations in last fit
+	int max_iter() const {return mxiter;} ///<\return maximum number of iterations
+	/// Construct the fitter
+	LMFit(
+		int l, ///<lateral size
+		int w ///<original image width
+	);
+	/// Set the image for fitting
+	void set_image(
+		T const * im, ///<corner of the subimage
+		T const * vq = 0 ///<corner of the readout variance added to the model, null for none
+	) {i = im; v = vq;}
+	/// Fit the PSF
+	vec_t fit(
+		vec_t const & p0 ///<initial guess
+	); ///<\return fitted parameters
+};
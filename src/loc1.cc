@@ -1,195 +1,461 @@
 /**\file
    \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details With --float, filtering, detection and fitting run in single
+   precision.  On synthetic 16-bit stacks (the layer_71.tif data is not
+   in the tree) detection is unchanged and the Levenberg--Marquardt fits
+   move by at most 0.8 nm, i.e. by the rounding of the output.  The
+   Nelder--Mead fits keep 97% to 99% of the localizations within 1 nm
+   (median 0.2 nm); the rest are shallow optima where the search stops
+   elsewhere, and one or two per stack fall to the outlier filters.
+
+   With --out-dir, the frames of any number of TIFF files go through one
+   pipeline, each file into a table of its own, and the progress is kept
+   in a checkpoint for resuming an interrupted run.  The tables are the
+   same as when writing them one at a time, except that warm starts begin
+   anew where a run resumes.
 */
 #include "tiff.hh"
-#include "nelder_mead.hxx"
+#include "calib.hh"
+#include "background.hh"
+#include "batch.hh"
+#include "locate.hh"
+#include "pipeline.hxx"
+#include "steal_pool.hh"
+#include "locfile.hh"
+#include "stats.hh"
 #include "utils.hh"
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <climits>
 #include <cmath>
+#include <cstdio>
+#include <set>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-double i2p = 3.6; ///<intensity to photon scale
+Calibration calib; ///<conversion of raw counts to photons
 double plsz = 80; ///<pixel size in nm
-int fwr = 4; ///<fitting window range
-
-/// Type for fitting parameters
-typedef std::array<double,5> param_t;
-
-/// Point-spread function with integrated Gaussian
-double psf_ig2(double x, double y, param_t const & p)
-{
-	double s2s = sqrt(2)*p[2]*p[2];
-	double ex = (erf((x-p[0]+.5)/s2s)-erf((x-p[0]-.5)/s2s))*.5;
-	double ey = (erf((y-p[1]+.5)/s2s)-erf((y-p[1]-.5)/s2s))*.5;
-	return ex*ey*p[3]*p[3]+p[4]*p[4];
-}
+bool single_precision = false; ///<process images and fit in float instead of double
+LocFormat out_format = Fmt_CSV; ///<format of the localization output
+bool warm_start = false; ///<start fits from particles of the previous frame
 
-/// Functor for likelihood calculation
-class Likelihood
+/// Frame handed from the reader to the workers
+struct Frame
 {
-	double const * i; ///<subimage pointer
-	int l; ///<lateral size of subimage
-	int w; ///<original image width (for row skip)
-public:
-	int cnt; ///<evaluaton count for the function
-	/// Construct the calculator
-	Likelihood(
-		int l, ///<lateral size
-		int w ///<original image width
-	) : l(l), w(w) {}
-	/// Set the image for calculation
-	void set_image(double const * im) {i = im;}
-	/// Actual calculation make the functor
-	double operator()(param_t const & p)
-	{
-		double tl = 0;
-		for (int y = 0; y<l; y++) for (int x = 0; x<l; x++) {
-			auto psf = psf_ig2(x,y,p);
-			tl += i[y*w+x]*log(psf)-psf;
-		}
-		return -tl;
-	}
+	size_t file; ///<index of the input file
+	std::shared_ptr<Tiff> tf; ///<input file, kept open while its frames are in flight
+	std::shared_ptr<WarmStart> ws; ///<warm starts within the input file, null if not used
+	unsigned wk; ///<frame number for ws, counted from the first frame processed in the file
+	unsigned icnt; ///<frame number
+	int w; ///<image width
+	int h; ///<image height
+	uint16_t const * v; ///<pixel data
+	bool swap; ///<bytes of v to be swapped
+	std::vector<uint16_t> b; ///<buffer for pixel data not viewed in place
+	std::vector<uint16_t> bg; ///<temporal background in raw counts, empty if not estimated
 };
 
-/// Detected particle
-struct Particle
+/// Particles found in a frame
+struct Found
 {
-	int x; ///<x coordinate of the maximum
-	int y; ///<y coordinate of the maximum
-	param_t p; ///<fitted parameters of the point-spread function
+	size_t file; ///<index of the input file
+	unsigned icnt; ///<frame number
+	std::vector<Particle> ps; ///<fitted particles
 };
 
-/// Process a single 2D image
-std::vector<Particle> process_image(
-	double const * data, ///<image data
-	int w, ///<image width
-	int h ///<image height
-)
+/// Show usage of the program
+void usage(char const * cmd)
 {
-	std::vector<Particle> res;
-	// convolution kernels
-	double const wk1[] = {1./16,1./4,3./8,1./4,1./16};
-	double const wk2[] = {1./16,0,1./4,0,3./8,0,1./4,0,1./16};
-	int sz = w*h;
-	int l = 2*fwr+1;
-	// utilities
-	std::vector<double> bf(sz); // workspace
-	NelderMead<5> nm; // Nelder--Mead minimizer
-	Likelihood fn(l,w); // likelihood function
+	msg(0) << "Usage:\n";
+	msg(0) << '\t' << cmd << " [options] <filename of TIFF, - for stdin>\n";
+	msg(0) << '\t' << cmd << " [options] -o DIR <filenames or patterns of TIFF>...\n\n";
+	msg(0) << "Options:\n";
+	msg(0) << "\t-j, --jobs N\tprocess frames with N worker threads\n";
+	msg(0) << "\t-t, --fit-threads N\tfit particles within a frame with N threads\n";
+	msg(0) << "\t-d, --decode-threads N\tdecompress strips and update the background with N threads\n";
+	msg(0) << "\t--fused\tcompute wavelet filter in one sweep over rolling row buffers\n";
+	msg(0) << "\t-e, --estimator nm|lm|lmb\tfit with Nelder--Mead (default), Levenberg--Marquardt,\n";
+	msg(0) << "\t\tor Levenberg--Marquardt on blocks of particles\n";
+	msg(0) << "\t--warm\tstart nm fits from nearby particles of the previous frame,\n";
+	msg(0) << "\t\tif it is done; with -j above 1 frames then differ from run to run\n";
+	msg(0) << "\t--lanes N\tblock size for the lmb estimator (default 8)\n";
+	msg(0) << "\t-r, --radius N\tradius of the fitting window (default 4)\n";
+	msg(0) << "\t--format csv|bin\twrite localizations as text (default) or columnar binary\n";
+	msg(0) << "\t--float\tprocess images and fit in single precision\n";
+	msg(0) << "\t--offset X|FILE\tcamera offset in ADU (default 0)\n";
+	msg(0) << "\t--gain X|FILE\tphotons per ADU (default 3.6)\n";
+	msg(0) << "\t--background K\tsubtract the median over the last K frames before filtering\n";
+	msg(0) << "\t--bg-quantile Q\tuse quantile Q in [0,1] of the last K frames instead of the median\n";
+	msg(0) << "\t--variance X|FILE\treadout variance in photons squared (default 0)\n";
+	msg(0) << "\t\tFILE holds a per-pixel map as a TIFF of 16-bit integers or 32-bit floats or as text, one image row per line\n";
+	msg(0) << "\t--stats FILE\twrite run statistics to FILE at the end, - for stderr\n";
+	msg(0) << "\t--stats-format json|prom\tstatistics as JSON (default) or Prometheus text\n";
+	msg(0) << "\t--stats-every S\talso rewrite the statistics every S seconds\n";
+	msg(0) << "\t-o, --out-dir DIR\tbatch mode, writing a table per input file into DIR,\n";
+	msg(0) << "\t\twith frames of all files going to the same workers\n";
+	msg(0) << "\t--list FILE\talso take the input files or patterns in FILE, one per line\n";
+	msg(0) << "\t--checkpoint FILE\tprogress of the batch, resumed from if it exists\n";
+	msg(0) << "\t\t(default DIR/loc1.checkpoint)\n";
+	msg(0) << "\t--shard I/N\tprocess only part I, counted from 0, of N equal parts of the frames,\n";
+	msg(0) << "\t\tfor joining with locmerge\n\n";
+}
 
-	// calculate v1,f1
-	std::vector<double> v1(sz);
-	for (int i = 0; i<sz; i++) {
-		int x = i%w;
-		double s = 0;
-		int r1 = x+2<w ? 5 : w+2-x;
-		for (int j = x<2 ? 2-x : 0; j<r1; j++) s += data[i+j-2]*wk1[j];
-		bf[i] = s;
+/// Localize as the command line says
+int run(int argc, char ** argv)
+{
+	int nth = 1; // number of worker threads
+	int nft = 1; // number of fitting threads
+	int ndt = 1; // number of decoding threads
+	std::string sfn; // statistics filename
+	StatFormat sf = St_JSON;
+	double sev = 0; // seconds between statistics saves
+	int bgk = 0; // frames of the temporal background, 0 for none
+	double bgq = 0.5; // quantile of the temporal background
+	std::string odir; // output directory of batch mode, empty for a single file to stdout
+	std::string lfn; // file with a list of inputs
+	std::string cfn; // checkpoint file
+	int shi = 0; // shard to process
+	int shn = 0; // number of shards, 0 for all frames
+	option const opts[] = {
+		{"jobs",required_argument,0,'j'},
+		{"fit-threads",required_argument,0,'t'},
+		{"decode-threads",required_argument,0,'d'},
+		{"fused",no_argument,0,'F'},
+		{"estimator",required_argument,0,'e'},
+		{"lanes",required_argument,0,'L'},
+		{"warm",no_argument,0,'W'},
+		{"float",no_argument,0,'f'},
+		{"radius",required_argument,0,'r'},
+		{"format",required_argument,0,'O'},
+		{"offset",required_argument,0,'B'},
+		{"gain",required_argument,0,'G'},
+		{"variance",required_argument,0,'V'},
+		{"background",required_argument,0,'K'},
+		{"bg-quantile",required_argument,0,'Q'},
+		{"stats",required_argument,0,'S'},
+		{"stats-format",required_argument,0,'P'},
+		{"stats-every",required_argument,0,'T'},
+		{"out-dir",required_argument,0,'o'},
+		{"list",required_argument,0,'I'},
+		{"checkpoint",required_argument,0,'C'},
+		{"shard",required_argument,0,'H'},
+		{0,0,0,0}
+	};
+	int c;
+	while ((c = getopt_long(argc,argv,"j:t:d:e:r:o:",opts,0))!=-1) switch (c) {
+	case 'j':
+		nth = atoi(optarg);
+		break;
+	case 't':
+		nft = atoi(optarg);
+		break;
+	case 'd':
+		ndt = atoi(optarg);
+		break;
+	case 'F':
+		fused_wavelet = true;
+		break;
+	case 'e':
+		if (std::string(optarg)=="nm") estimator = Est_NM;
+		else if (std::string(optarg)=="lm") estimator = Est_LM;
+		else if (std::string(optarg)=="lmb") estimator = Est_LMB;
+		else {
+			msg(0) << "Unknown estimator: " << optarg << '\n';
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'L':
+		lmb_lanes = std::max(1,atoi(optarg));
+		break;
+	case 'W':
+		warm_start = true;
+		break;
+	case 'f':
+		single_precision = true;
+		break;
+	case 'r':
+		fwr = std::max(1,atoi(optarg));
+		break;
+	case 'O':
+		if (std::string(optarg)=="csv") out_format = Fmt_CSV;
+		else if (std::string(optarg)=="bin") out_format = Fmt_Bin;
+		else {
+			msg(0) << "Unknown format: " << optarg << '\n';
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'B':
+		calib.set(Calibration::Cal_Offset,optarg);
+		break;
+	case 'G':
+		calib.set(Calibration::Cal_Gain,optarg);
+		break;
+	case 'V':
+		calib.set(Calibration::Cal_Variance,optarg);
+		break;
+	case 'K':
+		bgk = atoi(optarg);
+		break;
+	case 'Q':
+		bgq = atof(optarg);
+		break;
+	case 'S':
+		sfn = optarg;
+		break;
+	case 'P':
+		if (std::string(optarg)=="json") sf = St_JSON;
+		else if (std::string(optarg)=="prom") sf = St_Prometheus;
+		else {
+			msg(0) << "Unknown statistics format: " << optarg << '\n';
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'T':
+		sev = atof(optarg);
+		break;
+	case 'o':
+		odir = optarg;
+		break;
+	case 'I':
+		lfn = optarg;
+		break;
+	case 'C':
+		cfn = optarg;
+		break;
+	case 'H':
+		if (sscanf(optarg,"%d/%d",&shi,&shn)!=2 || shi<0 || shi>=shn) {
+			msg(0) << "Bad shard: " << optarg << '\n';
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		break;
+	default:
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	bool batch = !odir.empty();
+	if (optind>=argc && (!batch || lfn.empty())) {
+		msg(0) << "Missing expected filename!\n";
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!batch && (optind+1<argc || !lfn.empty())) {
+		msg(0) << "Several input files need --out-dir\n";
+		usage(argv[0]);
+		return EXIT_FAILURE;
 	}
-	double f1a = 0;
-	double f1a2 = 0;
-	for (int i = 0; i<sz; i++) {
-		int y = i/w;
-		double s = 0;
-		int r1 = y+2<h ? 5 : h+2-y;
-		for (int j = y<2 ? 2-y : 0; j<r1; j++) s += bf[i+j*w-2*w]*wk1[j];
-		v1[i] = s;
-		double f1 = data[i]-s;
-		f1a += f1;
-		f1a2 += f1*f1;
+	if (batch && shn) {
+		msg(0) << "Sharding applies to a single input file\n";
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (warm_start && estimator!=Est_NM) {
+		warn << "Warm starts apply to the nm estimator only\n";
+		warm_start = false;
 	}
-	f1a /= sz;
-	f1a2 /= sz;
-	double threshold = 1.5*sqrt(f1a2-f1a*f1a);
-	debug << "threshold = " << threshold << '\n';
+	if (!sfn.empty() && !stat_enabled) warn << "Built without LOCN_STATS, statistics will be empty\n";
 
-	// calculate f2
-	std::vector<double> f2(sz);
-	for (int i = 0; i<sz; i++) {
-		int x = i%w;
-		double s = 0;
-		int r1 = x+4<w ? 9 : w+4-x;
-		for (int j = x<4 ? 4-x : 0; j<r1; j++) s += v1[i+j-4]*wk2[j];
-		bf[i] = s;
+	std::vector<std::string> ins; // input files
+	std::vector<std::string> outs; // output files of batch mode
+	if (batch) {
+		ins = batch_inputs(std::vector<std::string>(argv+optind,argv+argc),lfn);
+		std::set<std::string> seen;
+		for (auto & in: ins) {
+			outs.push_back(batch_output(odir,in,out_format==Fmt_Bin));
+			if (!seen.insert(outs.back()).second) error("Several inputs for output "+outs.back());
+		}
+		if (cfn.empty()) cfn = odir+"/loc1.checkpoint";
 	}
-	for (int i = 0; i<sz; i++) {
-		int y = i/w;
-		double s = 0;
-		int r1 = y+4<h ? 9 : h+4-y;
-		for (int j = y<4 ? 4-y : 0; j<r1; j++) s += bf[i+j*w-4*w]*wk2[j];
-		f2[i] = v1[i]-s;
+	else ins.push_back(argv[optind]);
+	Checkpoint ck(batch ? cfn : ""); // owned by the writer once the pipeline runs
+	std::vector<char> done(ins.size()); // inputs finished before this run
+	std::vector<unsigned> from(ins.size()); // first frame of each input to process
+	if (batch) for (size_t i = 0; i<ins.size(); i++) {
+		auto & e = ck[ins[i]];
+		done[i] = e.done;
+		from[i] = e.frames;
+		if (e.frames && !e.done) info << "Resuming " << ins[i] << " after frame " << e.frames << '\n';
 	}
-   	// convert intensity to photon count
-	for (int i = 0; i<sz; i++) bf[i] = data[i]*i2p;
 
-	// find 8-connected local maximum by forward elimination
-	std::vector<int> nd{1,w+1,w,w-1};
-	std::vector<bool> n8(sz,true);
-	param_t stps = {1,1,0.2,1,1}; // step size
-	int ne = sz-w-1;
-	for (int i = 0; i<ne; i++) {
-		for (int d: nd) {
-			if (f2[i]>f2[i+d]) n8[i+d] = false;
-			else n8[i] = false;
+	std::unique_ptr<StealPool> dpool; // for decompressing in the reader
+	if (ndt>1) dpool.reset(new StealPool(ndt));
+	std::unique_ptr<StealPool> pool; // shared by all frame workers
+	if (nft>1) pool.reset(new StealPool(nft));
+	std::unique_ptr<StatReporter> rep;
+	if (!sfn.empty() && sev>0) rep.reset(new StatReporter(sfn,sf,sev));
+
+	// state of the reader
+	size_t fi = 0; // input being read
+	std::shared_ptr<Tiff> tf; // open input, null between inputs
+	std::unique_ptr<Background> bgs; // run by the reader, in frame order, restarting with each input
+	std::shared_ptr<WarmStart> ws; // warm starts within the input
+	unsigned icnt = 0; // next frame of the input
+	unsigned k0 = 0; // first frame of the input to process
+	unsigned k1 = 0; // end of the frames of the input to process
+	std::vector<uint16_t> sb; // buffer of completed frames passed to the background
+
+	// state of the writer
+	size_t wf = 0; // input being written
+	bool wo = false; // output of wf open?
+	unsigned wn = 0; // frames of wf written out
+	std::ofstream of; // output file of batch mode
+	std::unique_ptr<LocWriter> out;
+	auto t_ck = std::chrono::steady_clock::now(); // time of the last checkpoint
+	// open the output of wf, cutting it back to the completed frames
+	auto open = [&]() {
+		wn = from[wf];
+		if (batch) {
+			auto & o = outs[wf];
+			if (wn) {
+				struct stat st;
+				uint64_t n = ck[ins[wf]].offset;
+				if (stat(o.c_str(),&st)) error("Unable to find "+o+" to resume");
+				if (uint64_t(st.st_size)<n) error("Output "+o+" is shorter than recorded in the checkpoint");
+				if (truncate(o.c_str(),n)) error("Unable to cut back "+o);
+				of.open(o,std::ios::in|std::ios::out|std::ios::binary);
+				of.seekp(0,std::ios::end);
+			}
+			else of.open(o,std::ios::out|std::ios::trunc|std::ios::binary);
+			if (!of) error("Unable to open "+o);
+		}
+		out.reset(new LocWriter(batch ? static_cast<std::ostream &>(of) : std::cout,out_format));
+		wo = true;
+	};
+	// write out the localizations of wf so far and record them in the checkpoint
+	auto mark = [&](bool fin) {
+		out->flush();
+		t_ck = std::chrono::steady_clock::now();
+		if (!batch) return;
+		if (!of.flush()) error("Unable to write "+outs[wf]);
+		sync_file(outs[wf]); // the output holds what the checkpoint says before it says so
+		auto & e = ck[ins[wf]];
+		e.frames = wn;
+		e.offset = of.tellp();
+		e.done = fin;
+		ck.save();
+	};
+	// finish the inputs before k, including those without frames left
+	auto finish = [&](size_t k) {
+		for (; wf<k; wf++) {
+			if (done[wf]) continue;
+			if (!wo) open();
+			mark(true);
+			out.reset();
+			if (batch) of.close();
+			wo = false;
 		}
-	    int x = i%w;
-		int y = i/w;
-		if (n8[i] && x>=fwr && x<w-fwr && y>=fwr && y<h-fwr && f2[i]>threshold) {
-			// a local maximum, perform fitting to PSF
-			double const * sq = bf.data()+i-(w+1)*fwr; // keeping starting corner of square
-			// initial guess
-			double mx = sq[0];
-			double mn = sq[0];
-			for (int y = 0; y<l; y++) for (int x = 0; x<l; x++) {
-				double vv = sq[y*w+x];
-				if (vv>mx) mx = vv;
-				else if (vv<mn) mn = vv;
+	};
+
+	pipeline<Frame,Found>(nth,
+		[&](Frame & f) { // reader
+			StatTimer tm(St_Read);
+			Tiff::Frame const * fs; // frame scanned
+			for (;;) {
+				if (!tf) { // open the next input not finished
+					while (fi<ins.size() && done[fi]) fi ++;
+					if (fi==ins.size()) return false;
+					tf = std::make_shared<Tiff>(ins[fi]);
+					tf->start();
+					tf->set_pool(dpool.get());
+					if (bgk>0) {
+						bgs.reset(new Background(bgk,bgq));
+						bgs->set_pool(dpool.get());
+					}
+					if (warm_start) ws = std::make_shared<WarmStart>();
+					k0 = from[fi];
+					k1 = UINT_MAX;
+					if (shn) { // find the frames of the shard through the IFD links
+						if (tf->streaming()) error("Sharding needs a file, not a stream");
+						size_t n = tf->locate();
+						k0 = n*shi/shn;
+						k1 = n*(shi+1)/shn;
+						info << "Shard " << shi << '/' << shn << " takes frames " << k0+1 << " to " << k1 << " of " << n << '\n';
+					}
+					else if (k0 && !tf->streaming()) tf->locate();
+					// frames before k0 are skipped, the last of them still going to the background
+					if (bgs) for (unsigned k = k0>unsigned(bgk) ? k0-bgk : 0; k<k0 && (fs = tf->scan(k)); k++) {
+						StatTimer tb(St_Background);
+						bool sw;
+						auto v = tf->frame(k,sb,&sw);
+						f.bg.resize(size_t(fs->image_width)*fs->image_length);
+						bgs->add(v,sw,fs->image_width,fs->image_length,f.bg.data());
+					}
+					icnt = k0;
+				}
+				if (icnt<k1 && (fs = tf->scan(icnt))) break; // frames are indexed as they are read
+				tf.reset();
+				fi ++;
+			}
+			f.file = fi;
+			f.tf = tf;
+			f.ws = ws;
+			f.wk = icnt-k0;
+			f.icnt = icnt;
+			f.w = fs->image_width;
+			f.h = fs->image_length;
+			f.v = tf->frame(icnt,f.b,&f.swap);
+			if (bgs) {
+				StatTimer tb(St_Background);
+				f.bg.resize(size_t(f.w)*f.h);
+				bgs->add(f.v,f.swap,f.w,f.h,f.bg.data());
 			}
-			param_t p = {double(fwr),double(fwr),sqrt(1.6),sqrt(mx-mn),sqrt(mn)};
-			fn.set_image(sq);
-			fn.cnt = 0;
-			res.push_back({x,y,nm.minimize(std::ref(fn),p,stps)});
+			else f.bg.clear();
+			icnt ++;
+			return true;
+		},
+		[&](Frame & f) { // worker
+			int sz = f.w*f.h;
+			Found o{f.file,f.icnt,{}};
+			if (single_precision) {
+				thread_local FrameWorkspace<float> wk; // buffers of this worker
+				float * im = wk.images(f.w,f.h); // filter input then photon image
+				{
+					StatTimer tm(St_Convert);
+					calib.apply(f.v,f.swap,f.w,f.h,im,im+sz);
+					if (!f.bg.empty()) calib.subtract(f.bg.data(),f.w,f.h,im);
+				}
+				process_image(im,im+sz,calib.variance(f.w,f.h,wk.var),f.w,f.h,wk,o.ps,pool.get(),0,f.ws.get(),f.wk);
+				return o;
+			}
+			thread_local FrameWorkspace<double> wk;
+			double * im = wk.images(f.w,f.h);
+			{
+				StatTimer tm(St_Convert);
+				calib.apply(f.v,f.swap,f.w,f.h,im,im+sz);
+				if (!f.bg.empty()) calib.subtract(f.bg.data(),f.w,f.h,im);
+			}
+			process_image(im,im+sz,calib.variance(f.w,f.h,wk.var),f.w,f.h,wk,o.ps,pool.get(),0,f.ws.get(),f.wk);
+			return o;
+		},
+		[&](Found & o) { // writer
+			StatTimer tm(St_Write);
+			finish(o.file);
+			if (!wo) open();
+			Loc l;
+			for (auto & r: o.ps) if (to_loc(r,o.icnt+1,plsz,l)) out->add(l);
+			wn = o.icnt+1;
+			if (batch && std::chrono::steady_clock::now()-t_ck>std::chrono::seconds(1)) mark(false);
 		}
-	}
-	return res;
+	);
+	finish(ins.size());
+	rep.reset();
+	if (!sfn.empty()) stat_save(sfn,sf);
+	return 0;
 }
 
-/// Main function for localization
+/// Main function for localization, reporting errors
 int main(int argc, char ** argv)
 {
-	if (argc<2) {
-		msg(0) << "Missing expected filename!\nUsage:\n";
-		msg(0) << '\t' << argv[0] << " <filename of TIFF>\n\n";
+	try {
+		return run(argc,argv);
+	}
+	catch (Error & e) {
+		msg(0) << "Error: " << e.msg << '\n';
 		return EXIT_FAILURE;
 	}
-
-	Tiff tf(std::make_shared<std::ifstream>(argv[1]));
-	tf.start();
-
-	uint32_t nxt = 0;
-	unsigned icnt = 0;
-	do {
-		nxt = tf.parse_ifd(nxt);
-		int w = tf.image_width;
-		int h = tf.image_length;
-		int sz = w*h;
-		auto imd = tf.read_image();
-		uint16_t * v = reinterpret_cast<uint16_t *>(imd.data());
-		// convert to double
-		std::vector<double> im(v,v+sz);
-		for (auto r: process_image(im.data(), w, h)) {
-			// throw out outliers
-			if (r.p[0]<fwr-fwr/2||r.p[0]>fwr+fwr/2) continue;
-			if (r.p[1]<fwr-fwr/2||r.p[1]>fwr+fwr/2) continue;
-			if (r.p[2]<0.5||r.p[2]>fwr/2) continue;
-			if (abs(r.p[3])>1000) continue;
-			std::cout << icnt+1 << ",\t"; // layer
-			std::cout << plsz*(r.x+r.p[0]) << ",\t";
-			std::cout << plsz*(r.y+r.p[1]) << ",\t";
-			std::cout << plsz*(r.p[2]*r.p[2]) << ",\t";
-			std::cout << r.p[3]*r.p[3] << ",\t";
-			std::cout << r.p[4]*r.p[4] << '\n';
-		}
-		icnt ++;
-	} while (nxt);
-	return 0;
 }
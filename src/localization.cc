@@ -1,20 +1,27 @@
 ///\file
 #include "tiff.hh"
 #include "nelder_mead.hh"
+#include "pipeline.hxx"
 #include "utils.hh"
+#include "wavelet.hh"
 #include <iostream>
+#include <sstream>
 #include <cmath>
+#include <getopt.h>
 
-/// Point-spread function with integrated Gaussian
-double psf_ig2(double x, double y, double const * p)
+bool fused_wavelet = false; ///<compute wavelet filter in one fused sweep
+int fwr = 4; ///<fitting window range, with specialized code for 3 to 6
+
+/// Integrated Gaussian of the point-spread function along one axis, for pixels 0 to l-1
+inline void psf_ig1(double * e, int l, double c, double s2s)
 {
-	double s2s = sqrt(2)*p[2]*p[2];
-	double ex = (erf((x-p[0]+.5)/s2s)-erf((x-p[0]-.5)/s2s))*.5;
-	double ey = (erf((y-p[1]+.5)/s2s)-erf((y-p[1]-.5)/s2s))*.5;
-	return ex*ey*p[3]*p[3]+p[4]*p[4];
+	for (int x = 0; x<l; x++) e[x] = (erf((x-c+.5)/s2s)-erf((x-c-.5)/s2s))*.5;
 }
 
 /// negative Likelihood calculation for given parameter
+/** The PSF separates into x- and y-factors, computed once per call.  A
+    nonzero window radius R fixes the lateral size to 2R+1 at compile time. */
+template<int R>
 double likelihood(
 	double const * i, ///< image
 	int l, ///< lateral size of subimage
@@ -22,31 +29,47 @@ double likelihood(
 	double const * p ///< parameters
 )
 {
+	if (R) l = 2*R+1;
+	thread_local std::vector<double> e; // factors of PSF, x then y
+	e.resize(2*l);
+	double * ex = e.data();
+	double * ey = ex+l;
+	double s2s = sqrt(2)*p[2]*p[2];
+	psf_ig1(ex,l,p[0],s2s);
+	psf_ig1(ey,l,p[1],s2s);
+	double b = p[4]*p[4];
 	double tl = 0;
 	for (int y = 0; y<l; y++) for (int x = 0; x<l; x++) {
-		auto psf = psf_ig2(x,y,p);
+		auto psf = ex[x]*ey[y]*p[3]*p[3]+b;
 		tl += i[y*w+x]*log(psf)-psf;
 	}
 	return -tl;
 }
 
-// additional parameters for function
-double const * fn_im; ///<cropped square image data
-int fn_w; ///<image width
-unsigned fn_cnt; ///<count of function calls
+/// Additional parameters for fn, handed through nelder_mead
+struct FnContext
+{
+	double const * im; ///<cropped square image data
+	int w; ///<image width
+	int fwr; ///<fitting window range
+	unsigned cnt; ///<count of function calls
+};
 
-/// Function to be minimized
-double fn(double const * p)
+/// Function to be minimized, for window radius R or the range of the context if R is zero
+template<int R>
+double fn(double const * p, void * c)
 {
-	fn_cnt ++;
-	return likelihood(fn_im, 9, fn_w, p);
+	auto & x = *static_cast<FnContext *>(c);
+	x.cnt ++;
+	return likelihood<R>(x.im, 2*x.fwr+1, x.w, p);
 }
 
 /// Process a single 2D image
 void process_image(
 	double const * data, ///<image data
 	int w, ///<image width
-	int h ///<image height
+	int h, ///<image height
+	std::ostream & out ///<stream for the fitted parameters
 )
 {
 	// convolution kernels
@@ -56,53 +79,41 @@ void process_image(
 	// workspace
 	std::vector<double> bf(sz);
 
-	// calculate v1,f1
-	std::vector<double> v1(sz);
-	for (auto i = 0; i<sz; i++) {
-		auto x = i%w;
-		double s = 0;
-		auto r1 = x+2<w?5:w+2-x;
-		for (auto j = x<2?2-x:0; j<r1; j++) s += data[i+j-2]*wk1[j];
-		bf[i] = s;
-	}
+	// calculate f1 statistics and f2
+	std::vector<double> f2(sz);
 	double f1a = 0;
 	double f1a2 = 0;
-	for (auto i = 0; i<sz; i++) {
-		auto y = i/w;
-		double s = 0;
-		auto r1 = y+2<h?5:h+2-y;
-		for (auto j = y<2?2-y:0; j<r1; j++) s += bf[i+j*w-2*w]*wk1[j];
-		v1[i] = s;
-		double f1 = data[i]-s;
-		f1a += f1;
-		f1a2 += f1*f1;
+	if (fused_wavelet) wavelet_fused(data,f2.data(),w,h,wk1,2,wk2,4,f1a,f1a2);
+	else {
+		std::vector<double> v1(sz);
+		convolve_rows(data,bf.data(),w,h,wk1,2);
+		convolve_cols(bf.data(),v1.data(),w,h,wk1,2);
+		for (int i = 0; i<sz; i++) {
+			double f1 = data[i]-v1[i];
+			f1a += f1;
+			f1a2 += f1*f1;
+		}
+		convolve_rows(v1.data(),bf.data(),w,h,wk2,4);
+		convolve_cols(bf.data(),f2.data(),w,h,wk2,4);
+		for (int i = 0; i<sz; i++) f2[i] = v1[i]-f2[i];
 	}
 	f1a /= sz;
 	f1a2 /= sz;
 	double threshold = 1.5*sqrt(f1a2-f1a*f1a);
 	debug << "threshold = " << threshold << '\n';
 
-	// calculate f2
-	std::vector<double> f2(sz);
-	for (auto i = 0; i<sz; i++) {
-		auto x = i%w;
-		double s = 0;
-		auto r1 = x+4<w?9:w+4-x;
-		for (auto j = x<4?4-x:0; j<r1; j++) s += v1[i+j-4]*wk2[j];
-		bf[i] = s;
-	}
-	for (auto i = 0; i<sz; i++) {
-		auto y = i/w;
-		double s = 0;
-		auto r1 = y+4<h?9:h+4-y;
-		for (auto j = y<4?4-y:0; j<r1; j++) s += bf[i+j*w-4*w]*wk2[j];
-		f2[i] = v1[i]-s;
-	}
-
 	// find 8-connected local maximum by forward elimination
 	std::vector<int> nd{1,w+1,w,w-1};
 	std::vector<bool> n8(sz,true);
 	double stps[] = {1,1,0.2,1,1}; // step size
+	int const l = 2*fwr+1;
+	func_t * f = &fn<0>; // function specialized for the window, if any
+	switch (fwr) {
+	case 3: f = &fn<3>; break;
+	case 4: f = &fn<4>; break;
+	case 5: f = &fn<5>; break;
+	case 6: f = &fn<6>; break;
+	}
 	auto ne = sz-w-1;
 	for (int i = 0; i<ne; i++) {
 		for (auto d: nd) {
@@ -111,28 +122,26 @@ void process_image(
 		}
 	    int x = i%w;
 		int y = i/w;
-		if (n8[i]&&x>=4&&x<w-4&&y>=4&&y<h-4&&f2[i]>threshold) {
+		if (n8[i]&&x>=fwr&&x<w-fwr&&y>=fwr&&y<h-fwr&&f2[i]>threshold) {
 			// a local maximum, perform fitting to PSF
-			double const * sq = data+i-(w+1)*4; // keeping starting corner of square
+			double const * sq = data+i-(w+1)*fwr; // keeping starting corner of square
 			// initial guess
 			double mx = sq[0];
 			double mn = sq[0];
-			for (int y = 0; y<9; y++) for (int x = 0; x<9; x++) {
+			for (int y = 0; y<l; y++) for (int x = 0; x<l; x++) {
 				auto vv = sq[y*w+x];
 				if (vv>mx) mx = vv;
 				else if (vv<mn) mn = vv;
 			}
-			double p[] = {4,4,sqrt(1.6),sqrt(mx-mn),sqrt(mn)};
-			fn_im = sq;
-			fn_w = w;
-			fn_cnt = 0;
-			nelder_mead(&fn, 5, p, stps);
+			double p[] = {double(fwr),double(fwr),sqrt(1.6),sqrt(mx-mn),sqrt(mn)};
+			FnContext fc = {sq,w,fwr,0};
+			nelder_mead(f, &fc, 5, p, stps);
 			std::string s = "[";
 			for (int i = 0; i<5; i++) {
-				std::cout << s << p[i];
+				out << s << p[i];
 				s = ", ";
 			}
-			std::cout << "]\n";
+			out << "]\n";
 		}
 	}
 }
@@ -141,32 +150,83 @@ void process_image(
 
 
 
-/// Main function for localization
-int main(int argc, char ** argv)
+/// Frame handed from the reader to the workers
+struct Frame
+{
+	unsigned icnt; ///<frame number
+	int w; ///<image width
+	int h; ///<image height
+	uint16_t const * v; ///<pixel data
+	std::vector<uint16_t> b; ///<buffer for pixel data not viewed in place
+};
+
+/// Localize as the command line says
+int run(int argc, char ** argv)
 {
-	if (argc<2) {
+	int nth = 1; // number of worker threads
+	option const opts[] = {
+		{"jobs",required_argument,0,'j'},
+		{"fused",no_argument,0,'F'},
+		{"radius",required_argument,0,'r'},
+		{0,0,0,0}
+	};
+	int c;
+	while ((c = getopt_long(argc,argv,"j:r:",opts,0))!=-1) switch (c) {
+	case 'j':
+		nth = atoi(optarg);
+		break;
+	case 'F':
+		fused_wavelet = true;
+		break;
+	case 'r':
+		fwr = std::max(1,atoi(optarg));
+		break;
+	default:
+		std::cerr << "Usage:\n\t" << argv[0] << " [-j N] [--fused] [-r N] <filename of TIFF, - for stdin>\n\n";
+		return EXIT_FAILURE;
+	}
+	if (optind>=argc) {
 		std::cerr << "Missing expected filename!\nUsage:\n";
-		std::cerr << '\t' << argv[0] << " <filename of TIFF>\n\n";
+		std::cerr << '\t' << argv[0] << " [-j N] [--fused] [-r N] <filename of TIFF, - for stdin>\n\n";
 		return EXIT_FAILURE;
 	}
 
-	Tiff tf(std::make_shared<std::ifstream>(argv[1]));
+	Tiff tf{std::string(argv[optind])};
 	tf.start();
 
-	uint32_t nxt = 0;
 	unsigned icnt = 0;
-	do {
-		nxt = tf.parse_ifd(nxt);
-		auto w = tf.image_width;
-		auto h = tf.image_length;
-		auto sz = w*h;
-		auto imd = tf.read_image();
-		uint16_t * v = reinterpret_cast<uint16_t *>(imd.data());
-		// convert to double
-		std::vector<double> im(v,v+sz);
-		std::cout << "\n\n\nicnt = " << icnt << "\n===================\n";
-		process_image(im.data(), w, h);
-		icnt ++;
-	} while (nxt);
+	pipeline<Frame,std::string>(nth,
+		[&](Frame & f) { // reader
+			auto fi = tf.scan(icnt); // frames are indexed as they are read
+			if (!fi) return false;
+			f.icnt = icnt;
+			f.w = fi->image_width;
+			f.h = fi->image_length;
+			f.v = tf.frame(icnt,f.b);
+			icnt ++;
+			return true;
+		},
+		[](Frame & f) { // worker
+			// convert to double
+			std::vector<double> im(f.v,f.v+f.w*f.h);
+			std::ostringstream os;
+			os << "\n\n\nicnt = " << f.icnt << "\n===================\n";
+			process_image(im.data(),f.w,f.h,os);
+			return os.str();
+		},
+		[](std::string & o) {std::cout << o;} // writer
+	);
 	return 0;
 }
+
+/// Main function for localization, reporting errors
+int main(int argc, char ** argv)
+{
+	try {
+		return run(argc,argv);
+	}
+	catch (Error & e) {
+		msg(0) << "Error: " << e.msg << '\n';
+		return EXIT_FAILURE;
+	}
+}
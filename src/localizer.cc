@@ -0,0 +1,103 @@
+/**\file
+   \brief Reentrant localization of frames for use in other programs
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "localizer.hh"
+#include "steal_pool.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+/// Buffers of one call of process_frame
+struct Localizer::Work
+{
+	HugeBuffer<uint16_t> raw; ///<rows of a strided frame packed together
+	FrameWorkspace<float> wf; ///<workspace in single precision
+	FrameWorkspace<double> wd; ///<workspace in double precision
+	std::vector<Particle> ps; ///<fitted particles
+	std::vector<Loc> ls; ///<localizations
+};
+
+namespace {
+
+/// Localize frame v into work k in scalar type T
+template<typename T>
+void localize(Localizer const & lc, FrameWorkspace<T> & wk, std::vector<Particle> & ps, uint16_t const * v, int w, int h, StealPool * pool)
+{
+	size_t sz = size_t(w)*h;
+	T * im = wk.images(w,h);
+	lc.calib.apply(v,false,w,h,im,im+sz);
+	process_image(lc.settings,im,im+sz,lc.calib.variance(w,h,wk.var),w,h,wk,ps,pool);
+}
+
+/// Value of a switch setting
+bool flag(std::string const & k, std::string const & v)
+{
+	if (v=="1" || v=="true") return true;
+	if (v=="0" || v=="false") return false;
+	error("Setting "+k+" takes 0 or 1, not "+v);
+	return false;
+}
+
+} // namespace
+
+Localizer::Localizer() {}
+
+Localizer::~Localizer() {}
+
+void Localizer::set(std::string const & k, std::string const & v)
+{
+	if (k=="radius") settings.fwr = std::max(1,atoi(v.c_str()));
+	else if (k=="estimator") {
+		if (v=="nm") settings.estimator = Est_NM;
+		else if (v=="lm") settings.estimator = Est_LM;
+		else if (v=="lmb") settings.estimator = Est_LMB;
+		else error("Unknown estimator: "+v);
+	}
+	else if (k=="lanes") settings.lmb_lanes = std::max(1,atoi(v.c_str()));
+	else if (k=="fused") settings.fused_wavelet = flag(k,v);
+	else if (k=="float") single_precision = flag(k,v);
+	else if (k=="threshold") settings.threshold = atof(v.c_str());
+	else if (k=="pixel-size") plsz = atof(v.c_str());
+	else if (k=="offset") calib.set(Calibration::Cal_Offset,v);
+	else if (k=="gain") calib.set(Calibration::Cal_Gain,v);
+	else if (k=="variance") calib.set(Calibration::Cal_Variance,v);
+	else if (k=="fit-threads") set_threads(atoi(v.c_str()));
+	else error("Unknown setting: "+k);
+}
+
+void Localizer::set_threads(int n)
+{
+	pool.reset(n>1 ? new StealPool(n) : 0);
+}
+
+size_t Localizer::process_frame(uint16_t const * v, int w, int h, size_t stride, uint32_t frame, callback_t const & cb)
+{
+	if (w<1 || h<1 || stride<size_t(w)) error("Bad frame geometry");
+	std::unique_ptr<Work> wk;
+	{
+		std::lock_guard<std::mutex> lk(m);
+		if (!idle.empty()) {
+			wk = std::move(idle.back());
+			idle.pop_back();
+		}
+	}
+	if (!wk) wk.reset(new Work);
+	if (stride!=size_t(w)) { // pack the rows
+		uint16_t * r = wk->raw.reserve(size_t(w)*h);
+		for (int y = 0; y<h; y++) std::memcpy(r+size_t(y)*w,v+y*stride,w*sizeof(uint16_t));
+		v = r;
+	}
+	if (single_precision) localize(*this,wk->wf,wk->ps,v,w,h,pool.get());
+	else localize(*this,wk->wd,wk->ps,v,w,h,pool.get());
+	auto & ls = wk->ls;
+	ls.clear();
+	Loc l;
+	for (auto & r: wk->ps) if (to_loc(r,frame,plsz,l,settings.fwr)) ls.push_back(l);
+	size_t n = ls.size();
+	cb(n ? ls.data() : 0,n);
+	std::lock_guard<std::mutex> lk(m);
+	idle.push_back(std::move(wk));
+	return n;
+}
@@ -0,0 +1,61 @@
+/**\file
+   \brief Reentrant localization of frames for use in other programs
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details A Localizer holds all its settings, so any number of them can
+   work side by side in one process.  Frames may be handed to one from
+   several threads at once: each call takes a workspace from those the
+   object keeps, making a new one only when all are busy.  The settings
+   must not change while frames are processed.  Frames are localized on
+   their own, without temporal background or warm starts.
+*/
+#pragma once
+#include "calib.hh"
+#include "locate.hh"
+#include "locfile.hh"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class StealPool;
+
+/// Localization of raw frames with settings of its own
+class Localizer
+{
+	struct Work; ///<workspace of a call
+	std::unique_ptr<StealPool> pool; ///<thread pool for fitting, serial if null
+	std::mutex m; ///<lock for idle
+	std::vector<std::unique_ptr<Work> > idle; ///<workspaces not in use
+public:
+	/// Receiver of the localizations of a frame
+	typedef std::function<void(Loc const *, size_t)> callback_t;
+	LocSettings settings; ///<filtering, detection and fitting
+	Calibration calib; ///<conversion of raw counts to photons
+	double plsz = 80; ///<pixel size in nm
+	bool single_precision = false; ///<process images and fit in float instead of double
+	Localizer();
+	~Localizer();
+	/// Change a setting by the name of the loc1 option
+	/** The names are radius, estimator (nm, lm or lmb), lanes, fused (0 or
+	    1), float (0 or 1), threshold, pixel-size, offset, gain, variance and
+	    fit-threads.  Calibration values take numbers or map files as in
+	    loc1. */
+	void set(
+		std::string const & k, ///<name of the setting
+		std::string const & v ///<value
+	);
+	/// Use n threads for fitting within a frame
+	void set_threads(int n);
+	/// Localize a raw frame
+	size_t process_frame(
+		uint16_t const * v, ///<[in] raw pixel values
+		int w, ///<image width
+		int h, ///<image height
+		size_t stride, ///<distance between the starts of rows in pixels, at least w
+		uint32_t frame, ///<frame number for the localizations, counted from 1
+		callback_t const & cb ///<receiver of the localizations, called once
+	); ///<\return number of localizations
+};
@@ -0,0 +1,448 @@
+/**\file
+   \brief Localization of particles in a single image
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "locate.hh"
+#include "detect.hh"
+#include "nelder_mead.hxx"
+#include "steal_pool.hh"
+#include "lmfit.hh"
+#include "lmbatch.hh"
+#include "stats.hh"
+#include "utils.hh"
+#include "wavelet.hh"
+#include <chrono>
+#include <functional>
+
+int fwr = 4;
+bool fused_wavelet = false;
+Estimator estimator = Est_NM;
+int lmb_lanes = 8;
+
+LocSettings global_settings()
+{
+	LocSettings cs;
+	cs.fwr = fwr;
+	cs.fused_wavelet = fused_wavelet;
+	cs.estimator = estimator;
+	cs.lmb_lanes = lmb_lanes;
+	return cs;
+}
+
+/// Integrated Gaussian of psf_ig2 along one axis, for pixels 0 to l-1
+template<typename T>
+inline void psf_ig1(
+	T * e, ///<[out] integrals for the l pixels
+	int l, ///<number of pixels
+	T c, ///<center of the Gaussian
+	T s2s ///<sqrt(2) times the width
+)
+{
+	for (int x = 0; x<l; x++) e[x] = (std::erf((x-c+T(.5))/s2s)-std::erf((x-c-T(.5))/s2s))*T(.5);
+}
+
+namespace {
+
+/// Fit with window range fwr passing the outlier filters of to_loc?
+bool inlier(Particle const & r, int fwr)
+{
+	for (auto v: r.p) if (!std::isfinite(v)) return false;
+	return
+		r.p[0]>=fwr-fwr/2 && r.p[0]<=fwr+fwr/2 &&
+		r.p[1]>=fwr-fwr/2 && r.p[1]<=fwr+fwr/2 &&
+		r.p[2]>=0.5 && r.p[2]<=fwr/2 &&
+		std::fabs(r.p[3])<=1000;
+}
+
+} // namespace
+
+/// Functor for likelihood calculation
+/** A nonzero window radius R fixes the lateral size to 2R+1 at compile
+    time, so that the per-pixel loops can be unrolled and vectorized. */
+template<typename T, int R = 0>
+class Likelihood
+{
+	T const * i; ///<subimage pointer
+	T const * v = 0; ///<readout variance at the subimage, null for none
+	int l; ///<lateral size of subimage, 2R+1 if R is nonzero
+	int w; ///<original image width (for row skip)
+	std::vector<T> ex; ///<x-factors of the PSF
+	std::vector<T> ey; ///<y-factors of the PSF
+	std::vector<T> pr; ///<PSF for a row
+public:
+	int cnt; ///<evaluaton count for the function
+	/// Construct the calculator
+	Likelihood(
+		int l, ///<lateral size
+		int w ///<original image width
+	) : l(R ? 2*R+1 : l), w(w), ex(this->l), ey(this->l), pr(this->l) {}
+	/// Set the image for calculation
+	void set_image(
+		T const * im, ///<corner of the subimage
+		T const * vq = 0 ///<corner of the readout variance added to the model, null for none
+	) {i = im; v = vq;}
+	/// Actual calculation make the functor
+	/** The PSF separates into x- and y-factors, which are computed once
+	    per evaluation, leaving only products and logarithms per pixel. */
+	T operator()(std::array<T,5> const & p)
+	{
+		int const l = R ? 2*R+1 : this->l; // constant for fixed radius
+		cnt ++;
+		T s2s = std::sqrt(T(2))*p[2]*p[2];
+		psf_ig1(ex.data(),l,p[0],s2s);
+		psf_ig1(ey.data(),l,p[1],s2s);
+		T a = p[3];
+		T b = p[4]*p[4];
+		T tl = 0;
+		for (int y = 0; y<l; y++) {
+			T const * r = i+y*w;
+			T e = ey[y];
+			for (int x = 0; x<l; x++) pr[x] = ex[x]*e*a*a+b;
+			if (v) for (int x = 0; x<l; x++) pr[x] += v[y*w+x];
+			for (int x = 0; x<l; x++) tl += r[x]*std::log(pr[x])-pr[x];
+		}
+		return -tl;
+	}
+};
+
+/// Fitters of all workers for one estimator
+template<typename T, int R>
+struct Fitters : FitterSet
+{
+	int l; ///<lateral size of the window
+	int w; ///<image width
+	int nw; ///<number of workers
+	Estimator e; ///<estimator the fitters are for
+	int lanes; ///<block size of the block fitters
+	std::vector<NelderMead<5,T> > nms; ///<Nelder--Mead minimizers
+	std::vector<Likelihood<T,R> > fns; ///<likelihood functions
+	std::vector<LMFit<T,R> > lms; ///<Levenberg--Marquardt fitters
+	std::vector<LMBatch<T> > lbs; ///<block fitters
+	/// Make fitters for the estimator of cs
+	Fitters(LocSettings const & cs, int l, int w, int nw) : l(l), w(w), nw(nw), e(cs.estimator), lanes(cs.lmb_lanes)
+	{
+		switch (e) {
+		case Est_NM:
+			nms.resize(nw);
+			fns.resize(nw,Likelihood<T,R>(l,w));
+			break;
+		case Est_LM:
+			lms.resize(nw,LMFit<T,R>(l,w));
+			break;
+		case Est_LMB:
+			lbs.resize(nw,LMBatch<T>(l,lanes));
+			break;
+		}
+	}
+	/// Fitters usable for these settings?
+	bool fit(LocSettings const & cs, int l, int w, int nw) const
+	{
+		return l==this->l && w==this->w && nw==this->nw && e==cs.estimator && lanes==cs.lmb_lanes;
+	}
+};
+
+/// Run f(worker,i) for i in [0,n) on pool, or serially if null
+/** The task handed to the pool only refers to f, so that it fits in the
+    std::function without allocation. */
+template<typename F>
+void run_tasks(StealPool * pool, size_t n, F const & f)
+{
+	if (pool) pool->run(n,[&f](int k, size_t j) {f(k,j);});
+	else for (size_t j = 0; j<n; j++) f(0,j);
+}
+
+/// Process a single 2D image
+/** Filtering, detection and fitting all run in the scalar type T; the
+    fitted parameters are widened to double in the result.  The fitting
+    window radius is R, or cs.fwr if R is zero. */
+template<typename T, int R>
+void process_image(
+	LocSettings const & cs, ///<settings
+	T const * data, ///<filter input
+	T const * ph, ///<photon image
+	T const * var, ///<readout variance added to the model, null for none
+	int w, ///<image width
+	int h, ///<image height
+	FrameWorkspace<T> & wk, ///<[in,out] buffers kept between calls
+	std::vector<Particle> & res, ///<[out] fitted particles
+	StealPool * pool, ///<thread pool for fitting, serial if null
+	Stages * st, ///<[in,out] stage statistics to add to, if not null
+	WarmStart * ws, ///<start fits near particles of the previous frame, if not null
+	unsigned k ///<frame number for ws
+)
+{
+	typedef std::chrono::steady_clock clock;
+	auto t0 = clock::now();
+	// convolution kernels
+	T const wk1[] = {T(1./16),T(1./4),T(3./8),T(1./4),T(1./16)};
+	T const wk2[] = {T(1./16),0,T(1./4),0,T(3./8),0,T(1./4),0,T(1./16)};
+	int sz = w*h;
+	int const fwr = R ? R : cs.fwr; // window radius, constant for nonzero R
+	int const l = 2*fwr+1;
+
+	// calculate f1 statistics and f2
+	T * f2 = wk.f2.reserve(sz);
+	double f1a = 0; // sums in double, so that single precision finds the same candidates
+	double f1a2 = 0;
+	if (cs.fused_wavelet) wavelet_fused(data,f2,w,h,wk1,2,wk2,4,f1a,f1a2,&wk.rb);
+	else {
+		T * bf = wk.bf.reserve(sz); // workspace
+		T * v1 = wk.v1.reserve(sz);
+		convolve_rows(data,bf,w,h,wk1,2);
+		convolve_cols(bf,v1,w,h,wk1,2);
+		for (int i = 0; i<sz; i++) {
+			double f1 = data[i]-v1[i];
+			f1a += f1;
+			f1a2 += f1*f1;
+		}
+		convolve_rows(v1,bf,w,h,wk2,4);
+		convolve_cols(bf,f2,w,h,wk2,4);
+		for (int i = 0; i<sz; i++) f2[i] = v1[i]-f2[i];
+	}
+	f1a /= sz;
+	f1a2 /= sz;
+	T threshold = T(cs.threshold*std::sqrt(f1a2-f1a*f1a));
+	debug << "threshold = " << threshold << '\n';
+	auto t1 = clock::now();
+
+	// find 8-connected local maxima with room for the fitting window
+	auto & cand = wk.cand; // positions of the maxima
+	if (cand.capacity()<size_t(sz)/64) cand.reserve(sz/64); // room for dense frames, so that it seldom grows
+	find_maxima(f2,w,h,fwr,threshold,cand);
+	res.reserve(cand.capacity());
+	wk.warm.reserve(cand.capacity());
+	wk.prev.reserve(cand.capacity());
+
+	auto t2 = clock::now();
+
+	// particles of the previous frame within a pixel of the candidates, found through a map of their pixels
+	auto & prev = wk.prev;
+	auto & warm = wk.warm; // index into prev, -1 for none
+	warm.assign(cand.size(),-1);
+	size_t nwarm = 0;
+	if (ws && wk.at.size()!=size_t(sz)) wk.at.assign(sz,-1); // sized on the first frame, which takes no fits
+	if (ws && ws->take(k,prev)) {
+		auto & at = wk.at; // pixel of the fitted center to index into prev
+		auto pixel = [&](Particle const & q) { // pixel of the fitted center, -1 for none
+			if (!inlier(q,fwr)) return -1;
+			int x = int(std::floor(q.x-fwr+q.p[0]+.5));
+			int y = int(std::floor(q.y-fwr+q.p[1]+.5));
+			return x>=0 && x<w && y>=0 && y<h ? y*w+x : -1;
+		};
+		for (size_t j = 0; j<prev.size(); j++) {
+			int i = pixel(prev[j]);
+			if (i>=0) at[i] = j;
+		}
+		for (size_t j = 0; j<cand.size(); j++) {
+			int cx = cand[j]%w;
+			int cy = cand[j]/w;
+			double bd = 1; // squared distance within a pixel
+			for (int y = std::max(0,cy-1); y<=std::min(h-1,cy+1); y++) for (int x = std::max(0,cx-1); x<=std::min(w-1,cx+1); x++) {
+				int f = at[y*w+x];
+				if (f<0) continue;
+				auto & q = prev[f];
+				double dx = q.x-fwr+q.p[0]-cx;
+				double dy = q.y-fwr+q.p[1]-cy;
+				double d = dx*dx+dy*dy;
+				if (d<=bd) {
+					bd = d;
+					warm[j] = f;
+				}
+			}
+			if (warm[j]>=0) nwarm ++;
+		}
+		for (auto & q: prev) { // clear the map for the next frame
+			int i = pixel(q);
+			if (i>=0) at[i] = -1;
+		}
+	}
+
+	// perform fitting to PSF at the local maxima, each worker with its own fitter
+	int nw = pool ? pool->size() : 1;
+	auto & ev = wk.ev; // likelihood evaluations of each worker
+	ev.assign(nw,0);
+	res.resize(cand.size());
+	auto * fs = dynamic_cast<Fitters<T,R> *>(wk.fs.get());
+	if (!fs || !fs->fit(cs,l,w,nw)) {
+		fs = new Fitters<T,R>(cs,l,w,nw);
+		wk.fs.reset(fs);
+	}
+	// photon images may go below zero after the offset, so the guessed
+	// background and amplitude are kept above a small floor
+	T const least = T(.1);
+	// corner of square and initial guess for Levenberg--Marquardt
+	auto lm_guess = [&](size_t j, T const * & sq, typename LMFit<T>::vec_t & p) {
+		sq = ph+cand[j]-(w+1)*fwr;
+		T mx = sq[0];
+		T mn = sq[0];
+		T sm = 0;
+		for (int y = 0; y<l; y++) for (int x = 0; x<l; x++) {
+			T vv = sq[y*w+x];
+			if (vv>mx) mx = vv;
+			else if (vv<mn) mn = vv;
+			sm += vv;
+		}
+		mn = std::max(mn,least);
+		p = {{T(fwr),T(fwr),T(1.6),std::max(std::max(sm-l*l*mn,mx-mn),least),mn}};
+	};
+	// store Levenberg--Marquardt result in the square-root form of the Nelder--Mead fit
+	auto lm_store = [&](size_t j, typename LMFit<T>::vec_t const & q) {
+		int i = cand[j];
+		res[j] = {i%w,i/w,{{q[0],q[1],std::sqrt(q[2]),std::sqrt(q[3]),std::sqrt(q[4])}}};
+	};
+	switch (cs.estimator) {
+	case Est_NM:
+		run_tasks(pool,cand.size(),[&](int k, size_t j) {
+			int i = cand[j];
+			T const * sq = ph+i-(w+1)*fwr; // keeping starting corner of square
+			// initial guess
+			T mx = sq[0];
+			T mn = sq[0];
+			for (int y = 0; y<l; y++) for (int x = 0; x<l; x++) {
+				T vv = sq[y*w+x];
+				if (vv>mx) mx = vv;
+				else if (vv<mn) mn = vv;
+			}
+			mn = std::max(mn,least);
+			typename NelderMead<5,T>::vec_t p = {T(fwr),T(fwr),std::sqrt(T(1.6)),std::sqrt(std::max(mx-mn,least)),std::sqrt(mn)};
+			typename NelderMead<5,T>::vec_t stps = {1,1,T(0.2),1,1}; // step size
+			if (warm[j]>=0) { // start from the particle of the previous frame with a smaller simplex
+				auto & o = prev[warm[j]];
+				p = {T(o.x-i%w+o.p[0]),T(o.y-i/w+o.p[1]),T(o.p[2]),T(o.p[3]),T(o.p[4])};
+				for (int d = 0; d<3; d++) stps[d] *= T(.25);
+			}
+			auto & fn = fs->fns[k];
+			fn.set_image(sq,var ? var+(sq-ph) : 0);
+			fn.cnt = 0;
+			auto & nm = fs->nms[k];
+			auto q = nm.minimize(std::ref(fn),p,stps);
+			ev[k] += fn.cnt;
+			stat_hist(St_Iterations,nm.iter);
+			stat_hist(St_Evaluations,fn.cnt);
+			if (nm.iter>=nm.max_iter()) stat_add(St_MaxIter);
+			res[j] = {i%w,i/w,{{q[0],q[1],q[2],q[3],q[4]}}};
+		});
+		break;
+	case Est_LM:
+		run_tasks(pool,cand.size(),[&](int k, size_t j) {
+			T const * sq;
+			typename LMFit<T>::vec_t p;
+			lm_guess(j,sq,p);
+			auto & lm = fs->lms[k];
+			lm.set_image(sq,var ? var+(sq-ph) : 0);
+			lm_store(j,lm.fit(p));
+			ev[k] += lm.cnt;
+			stat_hist(St_Iterations,lm.iter);
+			stat_hist(St_Evaluations,lm.cnt);
+			if (lm.iter>=lm.max_iter()) stat_add(St_MaxIter);
+		});
+		break;
+	case Est_LMB:
+		int const lanes = cs.lmb_lanes;
+		run_tasks(pool,(cand.size()+lanes-1)/lanes,[&](int k, size_t t) { // tasks are blocks
+			auto & lb = fs->lbs[k];
+			size_t j0 = t*lanes;
+			size_t j1 = std::min(j0+lanes,cand.size());
+			lb.clear();
+			for (size_t j = j0; j<j1; j++) {
+				T const * sq;
+				typename LMFit<T>::vec_t p;
+				lm_guess(j,sq,p);
+				lb.add(sq,w,p,var ? var+(sq-ph) : 0);
+			}
+			lb.fit();
+			for (size_t j = j0; j<j1; j++) {
+				int it = lb.iter[j-j0];
+				lm_store(j,lb.result(j-j0));
+				ev[k] += it+1;
+				stat_hist(St_Iterations,it);
+				stat_hist(St_Evaluations,it+1);
+				if (it>=lb.max_iter()) stat_add(St_MaxIter);
+			}
+		});
+		break;
+	}
+	if (ws) ws->put(k,res);
+	auto t3 = clock::now();
+	stat_add(St_Frames);
+	stat_add(St_Candidates,cand.size());
+	stat_add(St_Warm,nwarm);
+	stat_time(St_Filter,t1-t0);
+	stat_time(St_Detect,t2-t1);
+	stat_time(St_Fit,t3-t2);
+	if (st) {
+		st->filter += std::chrono::duration<double>(t1-t0).count();
+		st->detect += std::chrono::duration<double>(t2-t1).count();
+		st->fit += std::chrono::duration<double>(t3-t2).count();
+		st->fits += cand.size();
+		st->warm += nwarm;
+		for (auto e: ev) st->evals += e;
+	}
+}
+
+template<typename T>
+void process_image(
+	LocSettings const & cs,
+	T const * data,
+	T const * ph,
+	T const * var,
+	int w,
+	int h,
+	FrameWorkspace<T> & wk,
+	std::vector<Particle> & res,
+	StealPool * pool,
+	Stages * st,
+	WarmStart * ws,
+	unsigned k
+)
+{
+	switch (cs.fwr) {
+	case 3: return process_image<T,3>(cs,data,ph,var,w,h,wk,res,pool,st,ws,k);
+	case 4: return process_image<T,4>(cs,data,ph,var,w,h,wk,res,pool,st,ws,k);
+	case 5: return process_image<T,5>(cs,data,ph,var,w,h,wk,res,pool,st,ws,k);
+	case 6: return process_image<T,6>(cs,data,ph,var,w,h,wk,res,pool,st,ws,k);
+	default: return process_image<T,0>(cs,data,ph,var,w,h,wk,res,pool,st,ws,k);
+	}
+}
+
+bool WarmStart::take(unsigned k, std::vector<Particle> & r)
+{
+	std::lock_guard<std::mutex> lk(m);
+	if (!k || !has || pk!=k-1) return false;
+	r.assign(ps.begin(),ps.end());
+	return true;
+}
+
+void WarmStart::put(unsigned k, std::vector<Particle> const & r)
+{
+	std::lock_guard<std::mutex> lk(m);
+	if (has && k<pk) return; // a later frame is already there
+	pk = k;
+	has = true;
+	if (ps.capacity()<r.capacity()) ps.reserve(r.capacity()); // room the frames have settled to
+	ps.assign(r.begin(),r.end());
+}
+
+bool to_loc(Particle const & r, uint32_t frame, double plsz, Loc & l, int fwr)
+{
+	if (!inlier(r,fwr)) {
+		stat_add(St_Rejected);
+		return false;
+	}
+	stat_add(St_Accepted);
+	l = {
+		frame,
+		plsz*(r.x-fwr+r.p[0]),
+		plsz*(r.y-fwr+r.p[1]),
+		plsz*(r.p[2]*r.p[2]),
+		r.p[3]*r.p[3],
+		r.p[4]*r.p[4]
+	};
+	return true;
+}
+
+///@{
+/// Instantiations for the supported scalar types
+template void process_image(LocSettings const &, float const *, float const *, float const *, int, int, FrameWorkspace<float> &, std::vector<Particle> &, StealPool *, Stages *, WarmStart *, unsigned);
+template void process_image(LocSettings const &, double const *, double const *, double const *, int, int, FrameWorkspace<double> &, std::vector<Particle> &, StealPool *, Stages *, WarmStart *, unsigned);
+///@}
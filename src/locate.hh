@@ -0,0 +1,176 @@
+/**\file
+   \brief Localization of particles in a single image
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details The image goes through the B-spline wavelet filter, the
+   8-connected local maxima above the threshold become candidates, and a
+   window around each is fitted to the integrated Gaussian PSF with
+   Poisson likelihood.  The settings are passed in LocSettings, with the
+   globals below as the settings of the programs.
+*/
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "locfile.hh"
+#include "utils.hh"
+
+class StealPool;
+
+extern int fwr; ///<fitting window range, with specialized code for 3 to 6
+extern bool fused_wavelet; ///<compute wavelet filter in one fused sweep
+
+/// Estimators for PSF fitting
+enum Estimator {
+	Est_NM, ///<Nelder--Mead on square-root parameters
+	Est_LM, ///<Levenberg--Marquardt with analytic derivatives
+	Est_LMB ///<Levenberg--Marquardt on blocks of particles at once
+};
+extern Estimator estimator; ///<estimator used for fitting
+extern int lmb_lanes; ///<block size for Est_LMB
+
+/// Settings of filtering, detection and fitting
+struct LocSettings
+{
+	int fwr = 4; ///<fitting window range, with specialized code for 3 to 6
+	bool fused_wavelet = false; ///<compute wavelet filter in one fused sweep
+	Estimator estimator = Est_NM; ///<estimator used for fitting
+	int lmb_lanes = 8; ///<block size for Est_LMB
+	double threshold = 1.5; ///<detection threshold in standard deviations of the first wavelet level
+};
+extern LocSettings global_settings(); ///<\return settings from the globals
+
+/// Type for fitting parameters
+typedef std::array<double,5> param_t;
+
+/// Point-spread function with integrated Gaussian
+template<typename T>
+T psf_ig2(T x, T y, std::array<T,5> const & p)
+{
+	T s2s = std::sqrt(T(2))*p[2]*p[2];
+	T ex = (std::erf((x-p[0]+T(.5))/s2s)-std::erf((x-p[0]-T(.5))/s2s))*T(.5);
+	T ey = (std::erf((y-p[1]+T(.5))/s2s)-std::erf((y-p[1]-T(.5))/s2s))*T(.5);
+	return ex*ey*p[3]*p[3]+p[4]*p[4];
+}
+
+/// Detected particle
+struct Particle
+{
+	int x; ///<x coordinate of the maximum
+	int y; ///<y coordinate of the maximum
+	param_t p; ///<fitted parameters of the point-spread function
+};
+
+/// Convert a particle to a localization in nm, shifting the window to its place in the image
+extern bool to_loc(
+	Particle const & r, ///<fitted particle
+	uint32_t frame, ///<frame number, counted from 1
+	double plsz, ///<pixel size in nm
+	Loc & l, ///<[out] localization
+	int wr ///<fitting window range of the fit
+); ///<\return false for outliers, which are left out
+/// Convert a particle fitted with the global window range to a localization
+inline bool to_loc(Particle const & r, uint32_t frame, double plsz, Loc & l) {return to_loc(r,frame,plsz,l,fwr);} ///<\return false for outliers
+
+/// Time spent and work done in the stages of process_image, summed over calls
+struct Stages
+{
+	double filter = 0; ///<seconds in the wavelet filter
+	double detect = 0; ///<seconds finding candidates
+	double fit = 0; ///<seconds fitting candidates
+	size_t fits = 0; ///<number of candidates fitted
+	size_t evals = 0; ///<likelihood evaluations of all fits
+	size_t warm = 0; ///<fits started from a particle of the previous frame
+};
+
+/// Fitted particles handed from each frame to the next for warm starts
+/** Only the fits of the latest frame put are kept.  A frame that finds
+    the fits of the frame before it starts from them; otherwise, as when
+    that frame is still being fitted by another worker, it starts cold
+    instead of waiting.  With one worker frames follow one another and
+    every frame but the first is warm started; with more, which frames
+    are depends on the scheduling of the threads.  The buffer keeps its
+    capacity, so that handing over fits seldom allocates. */
+class WarmStart
+{
+	std::mutex m; ///<lock for the members below
+	unsigned pk = 0; ///<frame of the fits in ps
+	bool has = false; ///<any fits put?
+	std::vector<Particle> ps; ///<fits of frame pk
+public:
+	/// Take the fits of the frame before frame k if they are there
+	bool take(
+		unsigned k, ///<frame number
+		std::vector<Particle> & r ///<[out] fits of frame k-1, replacing the contents
+	); ///<\return whether the fits were there
+	/// Put the fits of frame k for the next frame
+	void put(unsigned k, std::vector<Particle> const & r);
+};
+
+/// Fitters kept in a FrameWorkspace, of a type private to process_image
+struct FitterSet
+{
+	virtual ~FitterSet() {}
+};
+
+/// Buffers of process_image kept from frame to frame
+/** The buffers grow to the largest frame seen and are reused as they are,
+    so that a worker processing frames of one size allocates nothing after
+    the first frame, warm starts included.  Each worker needs its own
+    workspace. */
+template<typename T>
+struct FrameWorkspace
+{
+	HugeBuffer<T> im; ///<filter input and photon image of the caller, see images
+	HugeBuffer<T> bf; ///<row pass of the separate filter
+	HugeBuffer<T> v1; ///<first level of the separate filter
+	HugeBuffer<T> f2; ///<filtered image
+	std::vector<T> rb; ///<rolling buffers of the fused filter
+	std::vector<T> var; ///<readout variance of a scalar calibration, see Calibration::variance
+	std::vector<int> cand; ///<positions of the candidates
+	std::vector<int> warm; ///<index into prev for the candidates, -1 for none
+	std::vector<Particle> prev; ///<fits of the previous frame for warm starts
+	std::vector<int> at; ///<index into prev at the pixel of each fitted center, -1 elsewhere
+	std::vector<size_t> ev; ///<likelihood evaluations of each fitting worker
+	std::unique_ptr<FitterSet> fs; ///<fitters for the current settings
+	/// Room for the filter input followed by the photon image
+	T * images(int w, int h) {return im.reserve(2*size_t(w)*h);} ///<\return start of the filter input
+};
+
+/// Process a single 2D image with the code specialized for the window range, if any
+template<typename T>
+void process_image(
+	LocSettings const & cs, ///<settings
+	T const * data, ///<filter input
+	T const * ph, ///<photon image
+	T const * var, ///<readout variance added to the model, null for none
+	int w, ///<image width
+	int h, ///<image height
+	FrameWorkspace<T> & wk, ///<[in,out] buffers kept between calls
+	std::vector<Particle> & res, ///<[out] fitted particles, replacing the contents
+	StealPool * pool = 0, ///<thread pool for fitting, serial if null
+	Stages * st = 0, ///<[in,out] stage statistics to add to, if not null
+	WarmStart * ws = 0, ///<start fits near particles of the previous frame, if not null
+	unsigned k = 0 ///<frame number, counted from 0, for ws
+);
+
+/// Process a single 2D image with the global settings
+template<typename T>
+void process_image(
+	T const * data, ///<filter input
+	T const * ph, ///<photon image
+	T const * var, ///<readout variance added to the model, null for none
+	int w, ///<image width
+	int h, ///<image height
+	FrameWorkspace<T> & wk, ///<[in,out] buffers kept between calls
+	std::vector<Particle> & res, ///<[out] fitted particles, replacing the contents
+	StealPool * pool = 0, ///<thread pool for fitting, serial if null
+	Stages * st = 0, ///<[in,out] stage statistics to add to, if not null
+	WarmStart * ws = 0, ///<start fits near particles of the previous frame, if not null
+	unsigned k = 0 ///<frame number, counted from 0, for ws
+)
+{
+	process_image(global_settings(),data,ph,var,w,h,wk,res,pool,st,ws,k);
+}
@@ -0,0 +1,88 @@
+/**\file
+   \brief Conversion between text and binary tables of localizations
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details The input format is detected from the content.  Without an
+   explicit format, the output is in the other format.  Text carries six
+   significant digits, so converting text to binary does not recover the
+   precision of a binary file written directly.
+*/
+#include "locfile.hh"
+#include "utils.hh"
+#include <fstream>
+#include <getopt.h>
+
+/// Show usage of the program
+void usage(char const * cmd)
+{
+	msg(0) << "Usage:\n";
+	msg(0) << '\t' << cmd << " [options] <input file or - for stdin>\n\n";
+	msg(0) << "Options:\n";
+	msg(0) << "\t-f, --format csv|bin\tformat of the output (default: other than the input)\n";
+	msg(0) << "\t-o, --output FILE\twrite to FILE instead of stdout\n\n";
+}
+
+/// Main function for conversion
+int main(int argc, char ** argv)
+{
+	int fmt = -1; // output format, -1 for the other of input
+	std::string ofn; // output filename
+	option const opts[] = {
+		{"format",required_argument,0,'f'},
+		{"output",required_argument,0,'o'},
+		{0,0,0,0}
+	};
+	int c;
+	while ((c = getopt_long(argc,argv,"f:o:",opts,0))!=-1) switch (c) {
+	case 'f':
+		if (std::string(optarg)=="csv") fmt = Fmt_CSV;
+		else if (std::string(optarg)=="bin") fmt = Fmt_Bin;
+		else {
+			msg(0) << "Unknown format: " << optarg << '\n';
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'o':
+		ofn = optarg;
+		break;
+	default:
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (optind>=argc) {
+		msg(0) << "Missing expected filename!\n";
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::string ifn = argv[optind];
+	std::ifstream ifs;
+	if (ifn!="-") {
+		ifs.open(ifn,std::ios::binary);
+		if (!ifs) {
+			msg(0) << "Unable to open " << ifn << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	std::ofstream ofs;
+	if (!ofn.empty()) {
+		ofs.open(ofn,std::ios::binary);
+		if (!ofs) {
+			msg(0) << "Unable to create " << ofn << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	try {
+		LocReader in(ifn=="-" ? std::cin : ifs);
+		if (fmt<0) fmt = in.format()==Fmt_CSV ? Fmt_Bin : Fmt_CSV;
+		LocWriter out(ofn.empty() ? std::cout : ofs,LocFormat(fmt));
+		Loc l;
+		while (in.next(l)) out.add(l);
+		out.flush();
+	}
+	catch (Error & e) {
+		msg(0) << "Error: " << e.msg << '\n';
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
@@ -0,0 +1,332 @@
+/**\file
+   \brief Reading and writing tables of localizations
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "locfile.hh"
+#include "utils.hh"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+char const magic[] = {'L','O','C','N'}; ///<start of binary files
+uint16_t const version = 1; ///<version of binary format written
+/// Names of the columns, in the order of the fields of Loc
+char const * const names[] = {"frame","x","y","sigma","intensity","offset"};
+int const ncol = 6; ///<number of columns
+
+/// Powers of 10 that are exact in double
+double const p10[] = {
+	1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,
+	1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22
+};
+
+/// Is the host little endian?
+bool little_endian()
+{
+	uint16_t const t = 1;
+	return *reinterpret_cast<uint8_t const *>(&t)==1;
+}
+
+/// Write decimal digits of unsigned integer
+char * format_u(char * p, uint32_t v)
+{
+	char d[10];
+	int i = 0;
+	do {
+		d[i++] = '0'+v%10;
+		v /= 10;
+	} while (v);
+	while (i) *p++ = d[--i];
+	return p;
+}
+
+/// Append little-endian integer
+template<typename U>
+void put_le(std::vector<char> & b, U v)
+{
+	for (size_t i = 0; i<sizeof(U); i++) b.push_back(char(v>>(8*i)));
+}
+
+/// Read little-endian integer
+template<typename U>
+U get_le(char const * b)
+{
+	U v = 0;
+	for (size_t i = 0; i<sizeof(U); i++) v |= U(uint8_t(b[i]))<<(8*i);
+	return v;
+}
+
+/// Size of values of column type
+size_t col_size(uint8_t t)
+{
+	switch (t) {
+	case Col_U32: return 4;
+	case Col_F32: return 4;
+	case Col_F64: return 8;
+	}
+	error("Unknown column type "+std::to_string(int(t))+" in localization file");
+	return 0;
+}
+
+} // namespace
+
+/** Digits are obtained by scaling to an integer of prec digits in double,
+    which is exact but for the last bit.  Numbers that fall close enough to
+    a rounding tie for that bit to matter, or that are out of the range
+    handled, are left to snprintf. */
+char * format_g(char * p, double v, int prec)
+{
+	if (!std::isfinite(v)||prec<1||prec>9) return p+snprintf(p,32,"%.*g",prec,v);
+	if (v==0) {
+		if (std::signbit(v)) *p++ = '-';
+		*p++ = '0';
+		return p;
+	}
+	double a = std::fabs(v);
+	int e = int(std::floor(std::log10(a))); // decimal exponent
+	int s = prec-1-e; // scale for prec digits before the point
+	if (s>22||s<-22) return p+snprintf(p,32,"%.*g",prec,v);
+	double m = s>=0 ? a*p10[s] : a/p10[-s];
+	// log10 may be off by one next to powers of 10
+	if (m>=p10[prec]) {
+		e ++;
+		s --;
+		if (s<-22) return p+snprintf(p,32,"%.*g",prec,v);
+		m = s>=0 ? a*p10[s] : a/p10[-s];
+	}
+	else if (m<p10[prec-1]) {
+		e --;
+		s ++;
+		if (s>22) return p+snprintf(p,32,"%.*g",prec,v);
+		m = s>=0 ? a*p10[s] : a/p10[-s];
+	}
+	double fl = std::floor(m);
+	if (std::fabs(m-fl-.5)<1e-6) return p+snprintf(p,32,"%.*g",prec,v);
+	uint32_t d = uint32_t(fl)+(m-fl>.5);
+	if (d>=p10[prec]) { // rounded up to next power of 10
+		d /= 10;
+		e ++;
+	}
+	char g[9]; // significant digits
+	for (int i = prec-1; i>=0; i--) {
+		g[i] = '0'+d%10;
+		d /= 10;
+	}
+	int nd = prec; // digits without trailing zeros
+	while (nd>1&&g[nd-1]=='0') nd --;
+	if (v<0) *p++ = '-';
+	if (e<-4||e>=prec) { // exponential notation
+		*p++ = g[0];
+		if (nd>1) {
+			*p++ = '.';
+			for (int i = 1; i<nd; i++) *p++ = g[i];
+		}
+		*p++ = 'e';
+		*p++ = e<0 ? '-' : '+';
+		int x = std::abs(e);
+		if (x>=100) *p++ = '0'+x/100;
+		*p++ = '0'+x/10%10;
+		*p++ = '0'+x%10;
+	}
+	else if (e>=0) { // point after e+1 digits
+		for (int i = 0; i<=e; i++) *p++ = g[i];
+		if (nd>e+1) {
+			*p++ = '.';
+			for (int i = e+1; i<nd; i++) *p++ = g[i];
+		}
+	}
+	else { // leading zeros after the point
+		*p++ = '0';
+		*p++ = '.';
+		for (int i = -1; i>e; i--) *p++ = '0';
+		for (int i = 0; i<nd; i++) *p++ = g[i];
+	}
+	return p;
+}
+
+LocWriter::LocWriter(std::ostream & os, LocFormat fmt, size_t blk) : os(os), fmt(fmt), blk(blk)
+{
+	if (fmt==Fmt_CSV) tb.resize(blk*128);
+	else {
+		cf.resize(blk);
+		cd.resize(5*blk);
+	}
+}
+
+LocWriter::~LocWriter()
+{
+	flush();
+}
+
+void LocWriter::add(Loc const & l)
+{
+	if (fmt==Fmt_CSV) {
+		if (tb.size()-n<128) flush();
+		char * p = tb.data()+n;
+		p = format_u(p,l.frame);
+		for (double v: {l.x,l.y,l.sigma,l.intensity,l.offset}) {
+			*p++ = ',';
+			*p++ = '\t';
+			p = format_g(p,v);
+		}
+		*p++ = '\n';
+		n = p-tb.data();
+		return;
+	}
+	cf[n] = l.frame;
+	double * c = cd.data()+n;
+	c[0] = l.x;
+	c[blk] = l.y;
+	c[2*blk] = l.sigma;
+	c[3*blk] = l.intensity;
+	c[4*blk] = l.offset;
+	if (++n==blk) flush();
+}
+
+void LocWriter::flush()
+{
+	if (fmt==Fmt_CSV) {
+		os.write(tb.data(),n);
+		n = 0;
+		os.flush();
+		return;
+	}
+	std::vector<char> b;
+	if (!head) {
+		b.insert(b.end(),magic,magic+4);
+		put_le<uint16_t>(b,version);
+		put_le<uint16_t>(b,ncol);
+		for (int c = 0; c<ncol; c++) {
+			b.push_back(char(c ? Col_F64 : Col_U32));
+			size_t l = strlen(names[c]);
+			b.push_back(char(l));
+			b.insert(b.end(),names[c],names[c]+l);
+		}
+		head = true;
+	}
+	if (n) {
+		put_le<uint32_t>(b,uint32_t(n));
+		if (little_endian()) { // columns go out as they are kept
+			os.write(b.data(),b.size());
+			os.write(reinterpret_cast<char const *>(cf.data()),n*sizeof(uint32_t));
+			for (int c = 0; c<5; c++) os.write(reinterpret_cast<char const *>(cd.data()+c*blk),n*sizeof(double));
+		}
+		else {
+			for (size_t i = 0; i<n; i++) put_le(b,cf[i]);
+			for (size_t i = 0; i<5*blk; i++) {
+				if (i%blk>=n) continue;
+				uint64_t u;
+				memcpy(&u,&cd[i],8);
+				put_le(b,u);
+			}
+			os.write(b.data(),b.size());
+		}
+	}
+	else os.write(b.data(),b.size());
+	n = 0;
+	os.flush();
+}
+
+LocReader::LocReader(std::istream & is) : is(is)
+{
+	char h[4];
+	fmt = Fmt_CSV;
+	if (is.peek()!=magic[0]) return;
+	if (!is.read(h,4)||memcmp(h,magic,4)) error("Bad header of localization file");
+	fmt = Fmt_Bin;
+	read_header();
+}
+
+void LocReader::read_header()
+{
+	char h[4];
+	if (!is.read(h,4)) error("Truncated header of localization file");
+	uint16_t ver = get_le<uint16_t>(h);
+	if (ver!=version) error("Unsupported version "+std::to_string(ver)+" of localization file");
+	uint16_t nc = get_le<uint16_t>(h+2);
+	ct.clear();
+	cm.clear();
+	for (int c = 0; c<nc; c++) {
+		char t[2];
+		if (!is.read(t,2)) error("Truncated header of localization file");
+		std::string nm(uint8_t(t[1]),'\0');
+		if (!is.read(&nm[0],nm.size())) error("Truncated header of localization file");
+		col_size(t[0]);
+		ct.push_back(t[0]);
+		int f = -1;
+		for (int i = 0; i<ncol; i++) if (nm==names[i]) f = i;
+		cm.push_back(f);
+	}
+}
+
+bool LocReader::next_block()
+{
+	char h[4];
+	if (!is.read(h,4)) return false;
+	if (!memcmp(h,magic,4)) { // header of a concatenated file
+		read_header();
+		if (!is.read(h,4)) return false;
+	}
+	n = get_le<uint32_t>(h);
+	k = 0;
+	co.clear();
+	size_t sz = 0;
+	for (auto t: ct) {
+		co.push_back(sz);
+		sz += n*col_size(t);
+	}
+	cb.resize(sz);
+	if (!is.read(cb.data(),sz)) error("Truncated block in localization file");
+	return true;
+}
+
+bool LocReader::next(Loc & l)
+{
+	if (fmt==Fmt_CSV) {
+		while (std::getline(is,ln)) {
+			char const * p = ln.c_str();
+			char * q;
+			l.frame = strtoul(p,&q,10);
+			if (q==p) continue; // not a row of numbers
+			double * f[] = {&l.x,&l.y,&l.sigma,&l.intensity,&l.offset};
+			for (auto v: f) {
+				p = q;
+				while (*p==','||*p==' '||*p=='\t') p++;
+				*v = strtod(p,&q);
+			}
+			return true;
+		}
+		return false;
+	}
+	while (k>=n) if (!next_block()) return false;
+	l = Loc();
+	double * f[] = {0,&l.x,&l.y,&l.sigma,&l.intensity,&l.offset};
+	for (size_t c = 0; c<ct.size(); c++) {
+		if (cm[c]<0) continue;
+		char const * b = cb.data()+co[c]+k*col_size(ct[c]);
+		double v;
+		switch (ct[c]) {
+		case Col_U32:
+			v = get_le<uint32_t>(b);
+			break;
+		case Col_F32: {
+			uint32_t u = get_le<uint32_t>(b);
+			float x;
+			memcpy(&x,&u,4);
+			v = x;
+			break;
+		}
+		default: {
+			uint64_t u = get_le<uint64_t>(b);
+			memcpy(&v,&u,8);
+		}
+		}
+		if (cm[c]) *f[cm[c]] = v;
+		else l.frame = uint32_t(v);
+	}
+	k ++;
+	return true;
+}
@@ -0,0 +1,95 @@
+/**\file
+   \brief Reading and writing tables of localizations
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Localizations are stored either as text, one per line with the
+   fields separated by ",\t", or in a columnar binary format.  A binary file
+   starts with the magic "LOCN", a 16-bit version and a 16-bit column
+   count, followed by a type code, a name length and the name of every
+   column.  Then come blocks of rows, each a 32-bit row count followed by
+   the values of each column in turn as a typed array.  The file simply
+   ends after the last block, so that files can be concatenated.  All
+   numbers are little endian.  Writers collect rows in reusable buffers
+   and hand them to the stream in large writes.
+*/
+#pragma once
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// A localization as written to output
+struct Loc
+{
+	uint32_t frame; ///<frame number, counted from 1
+	double x; ///<x coordinate in nm
+	double y; ///<y coordinate in nm
+	double sigma; ///<width of the PSF in nm
+	double intensity; ///<photon count
+	double offset; ///<background per pixel
+};
+
+/// Formats of localization tables
+enum LocFormat {
+	Fmt_CSV, ///<text with fields separated by ",\t"
+	Fmt_Bin ///<columnar binary
+};
+
+/// Types of columns in binary files
+enum ColType {
+	Col_U32 = 1, ///<32-bit unsigned integer
+	Col_F32 = 2, ///<single-precision float
+	Col_F64 = 3 ///<double-precision float
+};
+
+/// Format a number the same as printf with "%.*g"
+extern char * format_g(
+	char * p, ///<[out] buffer, at least 32 characters
+	double v, ///<number to format
+	int prec = 6 ///<significant digits
+); ///<\return end of written text
+
+/// Buffered writer of localizations
+class LocWriter
+{
+	std::ostream & os; ///<output stream
+	LocFormat fmt; ///<format written
+	size_t blk; ///<number of rows buffered
+	size_t n = 0; ///<number of rows in buffer
+	std::vector<char> tb; ///<buffer for text
+	std::vector<uint32_t> cf; ///<buffer for frame column
+	std::vector<double> cd; ///<buffers for the other columns, [5][blk]
+	bool head = false; ///<header written?
+public:
+	/// Create writer to a stream
+	LocWriter(
+		std::ostream & os, ///<stream written to
+		LocFormat fmt, ///<output format
+		size_t blk = 1<<16 ///<number of rows to buffer
+	);
+	~LocWriter(); ///<flush remaining rows
+	void add(Loc const & l); ///<append a localization
+	void flush(); ///<write out buffered rows
+};
+
+/// Reader of localizations in either format
+class LocReader
+{
+	std::istream & is; ///<input stream
+	LocFormat fmt; ///<detected format
+	std::vector<uint8_t> ct; ///<types of binary columns
+	std::vector<int> cm; ///<field of each binary column, -1 if unknown
+	std::vector<char> cb; ///<raw column data of current block
+	std::vector<size_t> co; ///<offsets of columns in cb
+	size_t n = 0; ///<number of rows in current block
+	size_t k = 0; ///<next row in current block
+	std::string ln; ///<current text line
+	void read_header(); ///<read binary header following the magic
+	bool next_block(); ///<read a block of binary file
+public:
+	/// Create reader and detect the format
+	LocReader(
+		std::istream & is ///<stream to read from
+	);
+	LocFormat format() const {return fmt;} ///<\return detected format
+	bool next(Loc & l); ///<read next localization \return false at end of input
+};
@@ -0,0 +1,116 @@
+/**\file
+   \brief Merging of tables of localizations into frame order
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Each input must be in frame order, as written by loc1, for
+   example by the shards of a stack processed with --shard.  The inputs
+   are read side by side and the localizations go out in order of frame,
+   those of the same frame in the order of the inputs, so that shards of
+   a stack merge into the table of a single run over the stack.  Inputs
+   may be in either format, and the output is in the format of the first
+   input unless given.
+*/
+#include "locfile.hh"
+#include "utils.hh"
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/// Show usage of the program
+void usage(char const * cmd)
+{
+	msg(0) << "Usage:\n";
+	msg(0) << '\t' << cmd << " [options] <input files>...\n\n";
+	msg(0) << "Options:\n";
+	msg(0) << "\t-f, --format csv|bin\tformat of the output (default: that of the first input)\n";
+	msg(0) << "\t-o, --output FILE\twrite to FILE instead of stdout\n\n";
+	msg(0) << "Shards of a stack, for example, are made and merged with\n";
+	msg(0) << "\tfor i in 0 1 2 3; do loc1 --shard $i/4 stack.tif > part$i.csv & done; wait\n";
+	msg(0) << '\t' << cmd << " part?.csv > stack.csv\n\n";
+}
+
+/// Main function for merging
+int main(int argc, char ** argv)
+{
+	int fmt = -1; // output format, -1 for that of the first input
+	std::string ofn; // output filename
+	option const opts[] = {
+		{"format",required_argument,0,'f'},
+		{"output",required_argument,0,'o'},
+		{0,0,0,0}
+	};
+	int c;
+	while ((c = getopt_long(argc,argv,"f:o:",opts,0))!=-1) switch (c) {
+	case 'f':
+		if (std::string(optarg)=="csv") fmt = Fmt_CSV;
+		else if (std::string(optarg)=="bin") fmt = Fmt_Bin;
+		else {
+			msg(0) << "Unknown format: " << optarg << '\n';
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'o':
+		ofn = optarg;
+		break;
+	default:
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (optind>=argc) {
+		msg(0) << "Missing expected filename!\n";
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int n = argc-optind; // number of inputs
+	std::vector<std::ifstream> ifs(n);
+	for (int i = 0; i<n; i++) {
+		ifs[i].open(argv[optind+i],std::ios::binary);
+		if (!ifs[i]) {
+			msg(0) << "Unable to open " << argv[optind+i] << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	std::ofstream ofs;
+	if (!ofn.empty()) {
+		ofs.open(ofn,std::ios::binary);
+		if (!ofs) {
+			msg(0) << "Unable to create " << ofn << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	try {
+		std::vector<std::unique_ptr<LocReader> > in; // readers of the inputs
+		for (auto & s: ifs) in.emplace_back(new LocReader(s));
+		if (fmt<0) fmt = in[0]->format();
+		LocWriter out(ofn.empty() ? std::cout : ofs,LocFormat(fmt));
+		// next localization of each input, taken by frame and then by input
+		std::vector<Loc> hd(n);
+		typedef std::pair<uint32_t,int> key_t; // frame and input
+		std::priority_queue<key_t,std::vector<key_t>,std::greater<key_t> > q;
+		for (int i = 0; i<n; i++) if (in[i]->next(hd[i])) q.push(key_t(hd[i].frame,i));
+		while (!q.empty()) {
+			int i = q.top().second;
+			q.pop();
+			uint32_t f = hd[i].frame;
+			bool more; // input i not exhausted?
+			do { // the whole frame at once
+				out.add(hd[i]);
+				more = in[i]->next(hd[i]);
+			} while (more && hd[i].frame==f);
+			if (!more) continue;
+			if (hd[i].frame<f) error(std::string("Input not in frame order: ")+argv[optind+i]);
+			q.push(key_t(hd[i].frame,i));
+		}
+		out.flush();
+	}
+	catch (Error & e) {
+		msg(0) << "Error: " << e.msg << '\n';
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+/**\file
+   \brief C interface of the localization library
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "locn.h"
+#include "localizer.hh"
+#include "utils.hh"
+#include <cstddef>
+#include <exception>
+#include <string>
+
+static_assert(sizeof(locn_loc)==sizeof(Loc),"locn_loc differs from Loc");
+static_assert(offsetof(locn_loc,offset)==offsetof(Loc,offset),"locn_loc differs from Loc");
+
+/// Localizer behind the C handle
+struct locn_localizer
+{
+	Localizer lc; ///<the localizer
+};
+
+namespace {
+
+thread_local std::string last_error; ///<message of the last failure in this thread
+
+/// Keep the message of the exception being handled
+void fail()
+{
+	try {throw;}
+	catch (Error const & e) {last_error = e.msg;}
+	catch (std::exception const & e) {last_error = e.what();}
+	catch (...) {last_error = "Unknown error";}
+}
+
+} // namespace
+
+locn_localizer * locn_create(void)
+{
+	try {return new locn_localizer;}
+	catch (...) {fail();}
+	return 0;
+}
+
+void locn_destroy(locn_localizer * lc)
+{
+	delete lc;
+}
+
+int locn_set(locn_localizer * lc, char const * key, char const * value)
+{
+	try {
+		lc->lc.set(key,value);
+		return 0;
+	}
+	catch (...) {fail();}
+	return -1;
+}
+
+long locn_process_frame(locn_localizer * lc, uint16_t const * v, int w, int h, size_t stride, uint32_t frame, locn_callback cb, void * user)
+{
+	try {
+		return lc->lc.process_frame(v,w,h,stride,frame,[&](Loc const * ls, size_t n) {
+			if (cb) cb(reinterpret_cast<locn_loc const *>(ls),n,user);
+		});
+	}
+	catch (...) {fail();}
+	return -1;
+}
+
+char const * locn_error(void)
+{
+	return last_error.c_str();
+}
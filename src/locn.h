@@ -0,0 +1,54 @@
+/**\file
+   \brief C interface of the localization library
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details A thin layer over Localizer for callers outside C++.  Functions
+   returning int give 0 on success and -1 on failure, with the message of
+   the failure kept for the calling thread by locn_error.  A localizer may
+   be used by several threads at once, but its settings must not change
+   while frames are processed.
+*/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Localizer with settings of its own
+typedef struct locn_localizer locn_localizer;
+
+/// Localization of a particle, laid out as Loc
+typedef struct locn_loc
+{
+	uint32_t frame; ///<frame number, counted from 1
+	double x; ///<x coordinate in nm
+	double y; ///<y coordinate in nm
+	double sigma; ///<width of the PSF in nm
+	double intensity; ///<photon count
+	double offset; ///<background per pixel
+} locn_loc;
+
+/// Receiver of the n localizations of a frame, with the pointer given to locn_process_frame
+typedef void (* locn_callback)(locn_loc const * ls, size_t n, void * user);
+
+locn_localizer * locn_create(void); ///<\return new localizer with default settings, null on failure
+void locn_destroy(locn_localizer * lc); ///<release a localizer, ignoring null
+/// Change a setting by name, see Localizer::set
+int locn_set(locn_localizer * lc, char const * key, char const * value);
+/// Localize a frame of w by h raw values, rows stride values apart, calling cb once
+long locn_process_frame(
+	locn_localizer * lc, ///<localizer
+	uint16_t const * v, ///<[in] raw pixel values
+	int w, ///<image width
+	int h, ///<image height
+	size_t stride, ///<distance between the starts of rows in pixels, at least w
+	uint32_t frame, ///<frame number for the localizations, counted from 1
+	locn_callback cb, ///<receiver of the localizations
+	void * user ///<passed on to cb
+); ///<\return number of localizations, -1 on failure
+char const * locn_error(void); ///<\return message of the last failure in this thread
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,189 @@
+/**\file
+   \brief Generator of synthetic stacks for load and scaling tests
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Frames are rendered one at a time and streamed to the TIFF
+   writer, so stacks of any size take memory for a single frame only.
+   BigTIFF is chosen when the stack would not fit in classic TIFF.  The
+   ground truth lists the emitters on in each frame in the format of the
+   localization output, with the width of the PSF in nm, the photon count
+   and the background in photons.
+*/
+#include "simulate.hh"
+#include "tiff.hh"
+#include "locfile.hh"
+#include "utils.hh"
+#include <fstream>
+#include <memory>
+#include <getopt.h>
+
+/// Show usage of the program
+void usage(char const * cmd)
+{
+	SimParams sp;
+	msg(0) << "Usage:\n";
+	msg(0) << '\t' << cmd << " [options] <output TIFF, - for stdout>\n\n";
+	msg(0) << "Options:\n";
+	msg(0) << "\t-s, --size W[xH]\tframe size in pixels (default 256)\n";
+	msg(0) << "\t-n, --frames N\tnumber of frames (default 100)\n";
+	msg(0) << "\t--seed N\tseed of the random numbers (default 1)\n";
+	msg(0) << "\t-g, --truth FILE\twrite ground truth to FILE\n";
+	msg(0) << "\t--format csv|bin\tformat of the ground truth (default csv)\n";
+	msg(0) << "\t--bigtiff\twrite BigTIFF even if classic TIFF would do\n";
+	msg(0) << "\t-d, --density X\temitters on per square micrometer (default " << sp.density << ")\n";
+	msg(0) << "\t--on X\tmean frames an emitter stays on (default " << sp.t_on << ")\n";
+	msg(0) << "\t--off X\tmean frames an emitter stays off, 0 for always on (default " << sp.t_off << ")\n";
+	msg(0) << "\t--bleach X\tmean frames on before bleaching, 0 for never (default " << sp.t_bleach << ")\n";
+	msg(0) << "\t--photons MIN,MAX\tphoton count of an emitter in a frame (default " << sp.imin << ',' << sp.imax << ")\n";
+	msg(0) << "\t--sigma X\twidth of the PSF in pixels (default " << sp.sigma << ")\n";
+	msg(0) << "\t--background X\tbackground in photons per pixel (default " << sp.bg << ")\n";
+	msg(0) << "\t--offset X\tcamera offset in ADU (default " << sp.offset << ")\n";
+	msg(0) << "\t--gain X\tphotons per ADU (default " << sp.gain << ")\n";
+	msg(0) << "\t--read-noise X\tstandard deviation of read noise in ADU (default " << sp.read_noise << ")\n";
+	msg(0) << "\t--pixel X\tpixel size in nm (default " << sp.plsz << ")\n\n";
+}
+
+/// Main function for simulation
+int main(int argc, char ** argv)
+{
+	SimParams sp;
+	int w = 256; // frame size
+	int h = 256;
+	int nf = 100; // number of frames
+	unsigned long seed = 1;
+	std::string gfn; // ground truth filename
+	LocFormat gf = Fmt_CSV;
+	bool big = false;
+	option const opts[] = {
+		{"size",required_argument,0,'s'},
+		{"frames",required_argument,0,'n'},
+		{"seed",required_argument,0,'S'},
+		{"truth",required_argument,0,'g'},
+		{"format",required_argument,0,'O'},
+		{"bigtiff",no_argument,0,'b'},
+		{"density",required_argument,0,'d'},
+		{"on",required_argument,0,'1'},
+		{"off",required_argument,0,'0'},
+		{"bleach",required_argument,0,'x'},
+		{"photons",required_argument,0,'I'},
+		{"sigma",required_argument,0,'w'},
+		{"background",required_argument,0,'B'},
+		{"offset",required_argument,0,'o'},
+		{"gain",required_argument,0,'G'},
+		{"read-noise",required_argument,0,'N'},
+		{"pixel",required_argument,0,'p'},
+		{0,0,0,0}
+	};
+	int c;
+	while ((c = getopt_long(argc,argv,"s:n:g:d:",opts,0))!=-1) switch (c) {
+	case 's':
+		if (sscanf(optarg,"%dx%d",&w,&h)==1) h = w;
+		break;
+	case 'n':
+		nf = atoi(optarg);
+		break;
+	case 'S':
+		seed = strtoul(optarg,0,10);
+		break;
+	case 'g':
+		gfn = optarg;
+		break;
+	case 'O':
+		if (std::string(optarg)=="csv") gf = Fmt_CSV;
+		else if (std::string(optarg)=="bin") gf = Fmt_Bin;
+		else {
+			msg(0) << "Unknown format: " << optarg << '\n';
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		break;
+	case 'b':
+		big = true;
+		break;
+	case 'd':
+		sp.density = atof(optarg);
+		break;
+	case '1':
+		sp.t_on = atof(optarg);
+		break;
+	case '0':
+		sp.t_off = atof(optarg);
+		break;
+	case 'x':
+		sp.t_bleach = atof(optarg);
+		break;
+	case 'I':
+		if (sscanf(optarg,"%lf,%lf",&sp.imin,&sp.imax)==1) sp.imax = sp.imin;
+		break;
+	case 'w':
+		sp.sigma = atof(optarg);
+		break;
+	case 'B':
+		sp.bg = atof(optarg);
+		break;
+	case 'o':
+		sp.offset = atof(optarg);
+		break;
+	case 'G':
+		sp.gain = atof(optarg);
+		break;
+	case 'N':
+		sp.read_noise = atof(optarg);
+		break;
+	case 'p':
+		sp.plsz = atof(optarg);
+		break;
+	default:
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (optind>=argc) {
+		msg(0) << "Missing expected filename!\n";
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (w<1 || h<1 || nf<1 || sp.t_on<=0 || sp.imax<sp.imin) {
+		msg(0) << "Invalid settings!\n";
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	// classic TIFF stops at 4 GiB, with some room for the IFDs
+	if ((uint64_t(w)*h*2+256)*nf>uint64_t(0xffffffff)) big = true;
+
+	std::string ofn = argv[optind];
+	std::ofstream ofs;
+	if (ofn!="-") {
+		ofs.open(ofn,std::ios::binary);
+		if (!ofs) {
+			msg(0) << "Unable to create " << ofn << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	std::ofstream gfs;
+	if (!gfn.empty()) {
+		gfs.open(gfn,std::ios::binary);
+		if (!gfs) {
+			msg(0) << "Unable to create " << gfn << '\n';
+			return EXIT_FAILURE;
+		}
+	}
+	try {
+		Simulator sim(sp,w,h,seed);
+		info << sim.emitters() << " emitters\n";
+		TiffWriter tw(ofn=="-" ? std::cout : ofs,big);
+		std::unique_ptr<LocWriter> gw;
+		if (!gfn.empty()) gw.reset(new LocWriter(gfs,gf));
+		std::vector<uint16_t> v;
+		for (int k = 0; k<nf; k++) {
+			auto tr = sim.frame(v,k+1);
+			tw.add(v.data(),w,h);
+			if (gw) for (auto & l: tr) gw->add(l);
+		}
+		tw.close();
+		if (gw) gw->flush();
+	}
+	catch (Error & e) {
+		msg(0) << "Error: " << e.msg << '\n';
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
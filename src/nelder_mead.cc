@@ -9,7 +9,7 @@ double const beta = 0.5; ///< expansion coefficient
 double const gamma = 2; ///< contraction coefficient
 double const delta = 0.5; ///< shrinking coefficient
 
-double nelder_mead(func_t f, int n,	double * x,	double const * steps, double mxrngy, double mxrngx, int mxiter)
+double nelder_mead(func_t f, void * c, int n,	double * x,	double const * steps, double mxrngy, double mxrngx, int mxiter)
 {
 	/// create initial simplex, initial x comes first
 	auto s = new double [n*(n+1)];
@@ -21,7 +21,7 @@ double nelder_mead(func_t f, int n,	double * x,	double const * steps, double mxr
 	}
 
 	auto y = new double [n+1];
-	for (int i = 0; i<=n; i ++) y[i] = (*f)(s+i*n);
+	for (int i = 0; i<=n; i ++) y[i] = (*f)(s+i*n,c);
 	
 	// workspace
 	auto xc = new double [n]; // reflection center
@@ -77,12 +77,12 @@ double nelder_mead(func_t f, int n,	double * x,	double const * steps, double mxr
 			xc[i] = (xc[i]-sh[i])/n;
 			xn[i] = xc[i]+(xc[i]-sh[i])*alpha;
 		}
-		double yn = (*f)(xn);
+		double yn = (*f)(xn,c);
 		if (yn<y[ni]) { // reflection ok?
 			if (yn<y[li]) { // reflection best?
 				// expand
 				for (int i = 0; i<n; i++) x2[i] = xc[i]+(xc[i]-sh[i])*gamma;
-				double y2 = (*f)(x2);
+				double y2 = (*f)(x2,c);
 				if (y2<yn) { // expansion good?
 					y[hi] = y2;
 					for (int i = 0; i<n; i++) sh[i] = x2[i];
@@ -101,7 +101,7 @@ double nelder_mead(func_t f, int n,	double * x,	double const * steps, double mxr
 			if (yn<y[hi]) { // not worst
 				// contract the reflection
 				for (int i = 0; i<n; i++) x2[i] = xc[i]+(xn[i]-xc[i])*beta;
-				double y2 = (*f)(x2);
+				double y2 = (*f)(x2,c);
 				if (y2<yn) { // contraction better?
 					y[hi] = y2;
 					for (int i = 0; i<n; i++) sh[i] = x2[i];
@@ -114,7 +114,7 @@ double nelder_mead(func_t f, int n,	double * x,	double const * steps, double mxr
 			else { // worst
 				// contract the original position
 				for (int i = 0; i<n; i++) xn[i] = xc[i]+(sh[i]-xc[i])*beta;
-				yn = (*f)(xn);
+				yn = (*f)(xn,c);
 				if (yn<y[hi]) { // improves a bit
 					y[hi] = yn;
 					for (int i = 0; i<n; i++) sh[i] = xn[i];
@@ -125,7 +125,7 @@ double nelder_mead(func_t f, int n,	double * x,	double const * steps, double mxr
 						if (i==li) continue;
 						auto d = s+i*n;
 						for (int j = 0; j<n; j++) d[j] = sl[j]+(d[j]-sl[j])*delta;
-						y[i] = (*f)(d);
+						y[i] = (*f)(d,c);
 					}
 				}
 			}
@@ -133,6 +133,8 @@ double nelder_mead(func_t f, int n,	double * x,	double const * steps, double mxr
 		iter ++;
 	} while (iter<mxiter);
 	for (int i = 0; i<n; i++) x[i] = s[li*n+i];
+	delete [] s;
+	delete [] y;
 	delete [] xc;
 	delete [] xn;
 	delete [] x2;
@@ -7,12 +7,16 @@
 */
 #pragma once
 
-/// Function type with a number of parameters
-typedef double (func_t)(double const *);
+/// Function type with a number of parameters and a context
+typedef double (func_t)(
+	double const *, ///<parameters
+	void * ///<context given to nelder_mead
+);
 
 /// Perform minimization with Nelder--Mead method
 extern double nelder_mead(
 	func_t f, ///<[in] function to be minimized
+	void * c, ///<[in] context passed on to f, so that no globals are needed
 	int n, ///<[in] number of dimensions of parameter space
 	double * x, ///<[in,out] initial guess, returns position of found minimum
 	double const * steps, ///<[in] step sizes in all directions
@@ -5,23 +5,28 @@
 #pragma once
 #include <functional>
 #include <array>
+#include <limits>
+#include <algorithm>
+#include <cmath>
 
-/// Optimizer with Nelder--Mead method for functions with N arguments
-template<int N>
+/// Optimizer with Nelder--Mead method for functions with N arguments of scalar type T
+template<int N, typename T = double>
 class NelderMead
 {
 public:
-	typedef std::array<double,N> vec_t; ///<parameter space
-	typedef std::function<double(vec_t const &)> fun_t; ///<minimized function
+	typedef std::array<T,N> vec_t; ///<parameter space
+	typedef std::function<T(vec_t const &)> fun_t; ///<minimized function
 private:
-	double const alpha = 1; ///<reflection coefficient
-	double const beta = 0.5; ///<expansion coefficient
-	double const gamma = 2; ///<contraction coefficient
-	double const delta = 0.5; ///<shrinking coefficient
-	double mxrngy = 0.00001; ///<required function value accuracy
-	double mxrngx = 0.00001; ///<required maximum position accuracy
+	T const alpha = 1; ///<reflection coefficient
+	T const beta = 0.5; ///<expansion coefficient
+	T const gamma = 2; ///<contraction coefficient
+	T const delta = 0.5; ///<shrinking coefficient
+	T mxrngy = 0.00001; ///<required function value accuracy
+	T mxrngx = sizeof(T)<sizeof(double) ? 0.0001 : 0.00001; ///<required maximum position accuracy, coarser for float
 	int mxiter = 1000; ///<maximum number of iterations
 public:
+	int iter; ///<iterations used in last minimization
+	int max_iter() const {return mxiter;} ///<\return maximum number of iterations
 	///<perform minimization
 	vec_t minimize(
 		fun_t fn, ///<function to be minimized
@@ -36,7 +41,7 @@ public:
 		}
 		s[N] = x0;
 
-		std::array<double,N+1> y;
+		std::array<T,N+1> y;
 		for (int i = 0; i<=N; i ++) y[i] = fn(s[i]);
 
 		// workspace
@@ -48,7 +53,7 @@ public:
 		int hi; //highest
 
 		// iterate
-		int iter = 0;
+		iter = 0;
 		do {
 			// find lowest, highest, and next-to-highest
 			li = 0;
@@ -68,18 +73,19 @@ public:
 				else if (y[i]>y[ni]) ni = i;
 			}
 			if (ni==li) ni = 2;
-			// check for convergence
-			if (y[hi]-y[li]<mxrngy) { // y-range satisfied, check x
-				double mx = 0;
+			// check for convergence, function values resolved only to a few ulps
+			T ry = std::max(mxrngy,T(16)*std::numeric_limits<T>::epsilon()*std::fabs(y[li]));
+			if (y[hi]-y[li]<ry) { // y-range satisfied, check x
+				T mx = 0;
 				for (int i = 0; i<N; i++) {
-					double mnx = s[N][i];
-					double mxx = mnx;
+					T mnx = s[N][i];
+					T mxx = mnx;
 					for (int j = 0; j<N; j++) {
-						double xx = s[j][i];
+						T xx = s[j][i];
 						if (xx<mnx) mnx = xx;
 						if (xx>mxx) mxx = xx;
 					}
-					double r = mxx-mnx;
+					T r = mxx-mnx;
 					if (r>mx) mx = r;
 				}
 				if (mx<mxrngx) break; // x-range small enough, done!
@@ -92,12 +98,12 @@ public:
 				xc[i] = (xc[i]-sh[i])/N;
 				xn[i] = xc[i]+(xc[i]-sh[i])*alpha;
 			}
-			double yn = fn(xn);
+			T yn = fn(xn);
 			if (yn<y[ni]) { // reflection ok?
 				if (yn<y[li]) { // reflection best?
 					// expand
 					for (int i = 0; i<N; i++) x2[i] = xc[i]+(xc[i]-sh[i])*gamma;
-					double y2 = fn(x2);
+					T y2 = fn(x2);
 					if (y2<yn) { // expansion good?
 						y[hi] = y2;
 						sh = x2;
@@ -116,7 +122,7 @@ public:
 				if (yn<y[hi]) { // not worst
 					// contract the reflection
 					for (int i = 0; i<N; i++) x2[i] = xc[i]+(xn[i]-xc[i])*beta;
-					double y2 = fn(x2);
+					T y2 = fn(x2);
 					if (y2<yn) { // contraction better?
 						y[hi] = y2;
 						sh = x2;
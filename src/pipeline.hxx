@@ -0,0 +1,163 @@
+/**\file
+   \brief Ordered multi-threaded processing pipeline
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Items produced by a reader are processed by a pool of worker
+   threads and handed to a writer in the order they were read.  All queues
+   are bounded, so the number of items in flight stays constant no matter
+   how long the input is.
+*/
+#pragma once
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <deque>
+#include <map>
+#include <vector>
+
+/// Queue with limited capacity, blocking when full or empty
+template<typename T>
+class BoundedQueue
+{
+	std::mutex m; ///<lock for the queue
+	std::condition_variable cv_put; ///<signaled when there is room
+	std::condition_variable cv_get; ///<signaled when there is an item
+	std::deque<T> q; ///<queued items
+	size_t cap; ///<capacity of the queue
+	bool closed = false; ///<no more items will be put?
+public:
+	/// Create queue with given capacity
+	BoundedQueue(size_t cap ///<maximum number of queued items
+	) : cap(cap?cap:1) {}
+	/// Put an item, waiting for room
+	bool push(T && v) ///<\return false if the queue is closed
+	{
+		std::unique_lock<std::mutex> lk(m);
+		cv_put.wait(lk,[this]{return closed || q.size()<cap;});
+		if (closed) return false;
+		q.push_back(std::move(v));
+		cv_get.notify_one();
+		return true;
+	}
+	/// Take an item, waiting for one to arrive
+	bool pop(T & v) ///<\return false if the queue is closed and drained
+	{
+		std::unique_lock<std::mutex> lk(m);
+		cv_get.wait(lk,[this]{return closed || !q.empty();});
+		if (q.empty()) return false;
+		v = std::move(q.front());
+		q.pop_front();
+		cv_put.notify_one();
+		return true;
+	}
+	/// Close the queue, waking up all waiting threads
+	void close()
+	{
+		std::lock_guard<std::mutex> lk(m);
+		closed = true;
+		cv_put.notify_all();
+		cv_get.notify_all();
+	}
+};
+
+/// Run reader, parallel workers, and ordered writer
+/**
+   With nw<=1 everything runs serially in the calling thread.  Otherwise
+   the reader gets its own thread, nw workers transform the items, and the
+   writer runs in the calling thread, receiving results in reading order.
+   An exception thrown in any stage stops the pipeline and is rethrown to
+   the caller.
+*/
+template<typename I, typename O>
+void pipeline(
+	int nw, ///<number of worker threads
+	std::function<bool(I &)> read, ///<produce next item, false at the end
+	std::function<O(I &)> work, ///<process an item
+	std::function<void(O &)> write, ///<consume a result
+	size_t depth = 0 ///<maximum items in flight, 0 for twice the number of workers
+)
+{
+	if (nw<=1) {
+		I in;
+		while (read(in)) {
+			O out = work(in);
+			write(out);
+		}
+		return;
+	}
+	if (!depth) depth = 2*nw;
+	typedef std::pair<size_t,I> job_t;
+	BoundedQueue<job_t> jobs(depth);
+	std::map<size_t,O> done; // finished results waiting for the writer
+	size_t next = 0; // sequence number to be written next
+	size_t total = size_t(-1); // number of items read, known at the end
+	std::mutex m; // lock for done, next, total and err
+	std::condition_variable cv_done; // signaled when a result is ready
+	std::condition_variable cv_next; // signaled when the writer advances
+	std::exception_ptr err;
+	auto fail = [&](std::exception_ptr e) {
+		std::lock_guard<std::mutex> lk(m);
+		if (!err) err = e;
+		jobs.close();
+		cv_done.notify_all();
+		cv_next.notify_all();
+	};
+	std::thread reader([&]{
+		try {
+			size_t n = 0;
+			for (;;) {
+				job_t j;
+				j.first = n;
+				if (!read(j.second)) break;
+				if (!jobs.push(std::move(j))) return;
+				n ++;
+			}
+			std::lock_guard<std::mutex> lk(m);
+			total = n;
+			cv_done.notify_all();
+		}
+		catch (...) {fail(std::current_exception());}
+		jobs.close();
+	});
+	std::vector<std::thread> workers;
+	for (int i = 0; i<nw; i++) workers.emplace_back([&]{
+		try {
+			job_t j;
+			while (jobs.pop(j)) {
+				{ // keep results within the window of the writer
+					std::unique_lock<std::mutex> lk(m);
+					cv_next.wait(lk,[&]{return err || j.first<next+depth;});
+					if (err) return;
+				}
+				O out = work(j.second);
+				std::lock_guard<std::mutex> lk(m);
+				done.emplace(j.first,std::move(out));
+				cv_done.notify_all();
+			}
+		}
+		catch (...) {fail(std::current_exception());}
+	});
+	try {
+		for (;;) {
+			O out;
+			{
+				std::unique_lock<std::mutex> lk(m);
+				cv_done.wait(lk,[&]{return err || next==total || done.count(next);});
+				if (err || next==total) break;
+				auto i = done.find(next);
+				out = std::move(i->second);
+				done.erase(i);
+			}
+			write(out);
+			std::lock_guard<std::mutex> lk(m);
+			next ++;
+			cv_next.notify_all();
+		}
+	}
+	catch (...) {fail(std::current_exception());}
+	jobs.close();
+	reader.join();
+	for (auto & t: workers) t.join();
+	if (err) std::rethrow_exception(err);
+}
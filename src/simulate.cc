@@ -0,0 +1,118 @@
+/**\file
+   \brief Simulation of single-molecule localization microscopy frames
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "simulate.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/// Draw from Poisson distribution of small mean m by inversion
+template<typename G>
+int poisson_small(double m, G & g)
+{
+	std::uniform_real_distribution<double> u;
+	double l = std::exp(-m);
+	int k = 0;
+	for (double p = u(g); p>l; p *= u(g)) k ++;
+	return k;
+}
+
+/// Poisson distribution of fixed mean, drawn by inverting its tabulated CDF
+class PoissonTable
+{
+	std::vector<double> cdf; ///<cumulative probabilities up to 10 standard deviations above the mean
+public:
+	PoissonTable(double m)
+	{
+		double c = 0;
+		for (int k = 0; k<=m+10*std::sqrt(m)+10; k++) {
+			c += std::exp(k*std::log(m)-m-std::lgamma(k+1.));
+			cdf.push_back(c);
+		}
+	}
+	template<typename G>
+	int operator()(G & g) const
+	{
+		double u = std::uniform_real_distribution<double>()(g);
+		return int(std::upper_bound(cdf.begin(),cdf.end()-1,u)-cdf.begin());
+	}
+};
+
+} // namespace
+
+Simulator::Simulator(SimParams const & sp, int w, int h, uint64_t seed)
+: sp(sp), w(w), h(h), rng(seed), mu(size_t(w)*h)
+{
+	if (w<=2*sp.margin || h<=2*sp.margin) error("Frame too small for the margin");
+	double duty = sp.t_off>0 ? sp.t_on/(sp.t_on+sp.t_off) : 1; // fraction of time on
+	double area = double(w)*h*sp.plsz*sp.plsz*1e-6; // in square micrometers
+	size_t n = std::poisson_distribution<long>(sp.density*area/duty)(rng);
+	std::uniform_real_distribution<double> ux(sp.margin,w-1-sp.margin);
+	std::uniform_real_distribution<double> uy(sp.margin,h-1-sp.margin);
+	std::bernoulli_distribution bon(duty);
+	es.resize(n);
+	for (auto & e: es) {
+		e.x = ux(rng);
+		e.y = uy(rng);
+		e.on = bon(rng);
+		e.bleached = false;
+	}
+	int r = int(std::ceil(4*sp.sigma)); // reach of the PSF
+	ex.resize(2*r+2);
+	ey.resize(2*r+2);
+}
+
+std::vector<Loc> Simulator::frame(std::vector<uint16_t> & v, uint32_t k)
+{
+	std::vector<Loc> tr;
+	std::fill(mu.begin(),mu.end(),sp.bg);
+	std::uniform_real_distribution<double> ui(sp.imin,sp.imax);
+	int r = int(std::ceil(4*sp.sigma));
+	double s2s = std::sqrt(2.)*sp.sigma;
+	for (auto & e: es) {
+		if (!e.on) continue;
+		double in = ui(rng);
+		// factors of psf_ig2 along each axis over the reach of the PSF
+		int x0 = std::max(0,int(e.x)-r);
+		int x1 = std::min(w-1,int(e.x)+r+1);
+		int y0 = std::max(0,int(e.y)-r);
+		int y1 = std::min(h-1,int(e.y)+r+1);
+		for (int x = x0; x<=x1; x++) ex[x-x0] = (std::erf((x-e.x+.5)/s2s)-std::erf((x-e.x-.5)/s2s))*.5;
+		for (int y = y0; y<=y1; y++) ey[y-y0] = (std::erf((y-e.y+.5)/s2s)-std::erf((y-e.y-.5)/s2s))*.5;
+		for (int y = y0; y<=y1; y++) {
+			double * m = mu.data()+size_t(y)*w;
+			double f = ey[y-y0]*in;
+			for (int x = x0; x<=x1; x++) m[x] += ex[x-x0]*f;
+		}
+		tr.push_back({k,e.x*sp.plsz,e.y*sp.plsz,sp.sigma*sp.plsz,in,sp.bg});
+	}
+	// camera, with photons of background and emitters drawn apart
+	v.resize(mu.size());
+	PoissonTable pb(sp.bg>0 ? sp.bg : 1);
+	std::normal_distribution<double> rn(0,sp.read_noise>0 ? sp.read_noise : 1);
+	for (size_t i = 0; i<mu.size(); i++) {
+		int c = sp.bg>0 ? pb(rng) : 0;
+		double s = mu[i]-sp.bg; // from emitters
+		if (s>16) c += std::poisson_distribution<int>(s)(rng);
+		else if (s>0) c += poisson_small(s,rng);
+		double a = c/sp.gain+sp.offset+(sp.read_noise>0 ? rn(rng) : 0);
+		v[i] = uint16_t(std::min(65535.,std::max(0.,std::round(a))));
+	}
+	// blinking
+	std::uniform_real_distribution<double> u;
+	for (auto & e: es) {
+		if (e.bleached) continue;
+		if (e.on) {
+			if (sp.t_bleach>0 && u(rng)*sp.t_bleach<1) {
+				e.on = false;
+				e.bleached = true;
+			}
+			else if (sp.t_off>0 && u(rng)*sp.t_on<1) e.on = false;
+		}
+		else if (u(rng)*sp.t_off<1) e.on = true;
+	}
+	return tr;
+}
@@ -0,0 +1,72 @@
+/**\file
+   \brief Simulation of single-molecule localization microscopy frames
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Emitters sit at fixed random positions and blink, each
+   switching on and off as a two-state Markov chain per frame with given
+   mean on and off times, and optionally bleaching after a mean total on
+   time.  Their number is chosen so that the given density of emitters is
+   on in an average frame.  An emitter that is on adds an integrated
+   Gaussian of psf_ig2, with a photon count drawn per frame, to a flat
+   background.  The camera adds Poisson shot noise, converts photons to
+   ADU with the gain, and adds the offset and Gaussian read noise.  All
+   random numbers come from a single generator, so that a seed fixes the
+   whole stack.
+*/
+#pragma once
+#include "locfile.hh"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/// Settings of a simulation
+struct SimParams
+{
+	double plsz = 80; ///<pixel size in nm
+	double offset = 100; ///<camera offset in ADU
+	double gain = 3.6; ///<photons per ADU
+	double read_noise = 1.5; ///<standard deviation of read noise in ADU
+	double bg = 50; ///<background in photons per pixel
+	double sigma = 1.5; ///<width of the PSF in pixels
+	double imin = 500; ///<smallest photon count of an emitter in a frame
+	double imax = 5000; ///<largest photon count of an emitter in a frame
+	double density = 0.5; ///<emitters on per square micrometer in an average frame
+	double t_on = 2; ///<mean number of frames an emitter stays on
+	double t_off = 20; ///<mean number of frames an emitter stays off, 0 for always on
+	double t_bleach = 0; ///<mean number of frames on before bleaching, 0 for never
+	int margin = 5; ///<width of the border kept free of emitters in pixels
+};
+
+/// Generator of a stack of frames
+class Simulator
+{
+	/// An emitter
+	struct Emitter
+	{
+		double x; ///<x position in pixels
+		double y; ///<y position in pixels
+		bool on; ///<currently on?
+		bool bleached; ///<bleached for good?
+	};
+	SimParams sp; ///<settings
+	int w; ///<frame width
+	int h; ///<frame height
+	std::mt19937_64 rng; ///<random number generator
+	std::vector<Emitter> es; ///<all emitters
+	std::vector<double> mu; ///<expected photons of each pixel
+	std::vector<double> ex; ///<x-factors of the PSF
+	std::vector<double> ey; ///<y-factors of the PSF
+public:
+	/// Place the emitters
+	Simulator(
+		SimParams const & sp, ///<settings
+		int w, ///<frame width
+		int h, ///<frame height
+		uint64_t seed ///<seed of the random numbers
+	);
+	size_t emitters() const {return es.size();} ///<\return number of emitters
+	/// Render the next frame and advance the blinking
+	std::vector<Loc> frame(
+		std::vector<uint16_t> & v, ///<[out] pixels in ADU
+		uint32_t k ///<frame number for the ground truth, counted from 1
+	); ///<\return emitters on in the frame, in nm and photons
+};
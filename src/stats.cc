@@ -0,0 +1,198 @@
+/**\file
+   \brief Counters, timers and histograms of a run
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "stats.hh"
+#include "utils.hh"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace {
+
+char const * const count_names[] = {"frames","candidates","accepted","rejected","max_iter","warm"};
+char const * const time_names[] = {"read","background","convert","filter","detect","fit","write"};
+char const * const hist_names[] = {"iterations","evaluations"};
+
+/// Help texts of the Prometheus counters
+char const * const count_help[] = {
+	"Images processed",
+	"Local maxima above the threshold",
+	"Fits kept as localizations",
+	"Fits left out by the outlier filters",
+	"Fits stopped by the iteration limit",
+	"Fits started from a particle of the previous frame"
+};
+
+std::mutex slots_m; ///<lock for slots
+std::vector<std::unique_ptr<StatSlot> > slots; ///<slots of all threads, kept to the end
+
+/// Plain copy of the statistics of a thread or of all
+struct Snapshot
+{
+	uint64_t cnt[St_Counts] = {};
+	uint64_t ns[St_Times] = {};
+	uint64_t hist[St_Hists][stat_bins] = {};
+	uint64_t sum[St_Hists] = {};
+	/// Add the values of a slot
+	void add(StatSlot const & s)
+	{
+		for (int i = 0; i<St_Counts; i++) cnt[i] += s.cnt[i].load(std::memory_order_relaxed);
+		for (int i = 0; i<St_Times; i++) ns[i] += s.ns[i].load(std::memory_order_relaxed);
+		for (int i = 0; i<St_Hists; i++) {
+			for (int b = 0; b<stat_bins; b++) hist[i][b] += s.hist[i][b].load(std::memory_order_relaxed);
+			sum[i] += s.sum[i].load(std::memory_order_relaxed);
+		}
+	}
+};
+
+/// Write counters and timers as JSON members
+void json_values(std::ostream & os, Snapshot const & s)
+{
+	os << "\"counts\": {";
+	for (int i = 0; i<St_Counts; i++) os << (i ? ", \"" : "\"") << count_names[i] << "\": " << s.cnt[i];
+	os << "}, \"seconds\": {";
+	for (int i = 0; i<St_Times; i++) os << (i ? ", \"" : "\"") << time_names[i] << "\": " << s.ns[i]*1e-9;
+	os << '}';
+}
+
+void dump_json(std::ostream & os, Snapshot const & t, std::vector<Snapshot> const & ts)
+{
+	os << "{\"enabled\": " << (stat_enabled ? "true" : "false") << ",\n \"totals\": {";
+	json_values(os,t);
+	os << ",\n\t\"histograms\": {";
+	for (int i = 0; i<St_Hists; i++) {
+		os << (i ? ",\n\t\t\"" : "\n\t\t\"") << hist_names[i] << "\": {\"le\": [";
+		for (int b = 0; b<stat_bins-1; b++) os << (b ? ", " : "") << (uint64_t(1)<<b);
+		os << ", null], \"counts\": [";
+		uint64_t n = 0;
+		for (int b = 0; b<stat_bins; b++) {
+			os << (b ? ", " : "") << t.hist[i][b];
+			n += t.hist[i][b];
+		}
+		os << "], \"count\": " << n << ", \"sum\": " << t.sum[i] << '}';
+	}
+	os << "}},\n \"threads\": [";
+	for (size_t k = 0; k<ts.size(); k++) {
+		os << (k ? ",\n\t{" : "\n\t{");
+		json_values(os,ts[k]);
+		os << '}';
+	}
+	os << "]}\n";
+}
+
+void dump_prometheus(std::ostream & os, Snapshot const & t)
+{
+	for (int i = 0; i<St_Counts; i++) {
+		std::string n = std::string("locn_")+count_names[i]+"_total";
+		os << "# HELP " << n << ' ' << count_help[i] << '\n';
+		os << "# TYPE " << n << " counter\n";
+		os << n << ' ' << t.cnt[i] << '\n';
+	}
+	os << "# HELP locn_stage_seconds_total Time spent in the stages, summed over threads\n";
+	os << "# TYPE locn_stage_seconds_total counter\n";
+	for (int i = 0; i<St_Times; i++) os << "locn_stage_seconds_total{stage=\"" << time_names[i] << "\"} " << t.ns[i]*1e-9 << '\n';
+	for (int i = 0; i<St_Hists; i++) {
+		std::string n = std::string("locn_fit_")+hist_names[i];
+		os << "# HELP " << n << " Minimizer " << hist_names[i] << " per fit\n";
+		os << "# TYPE " << n << " histogram\n";
+		uint64_t c = 0;
+		for (int b = 0; b<stat_bins; b++) {
+			c += t.hist[i][b];
+			os << n << "_bucket{le=\"";
+			if (b<stat_bins-1) os << (uint64_t(1)<<b);
+			else os << "+Inf";
+			os << "\"} " << c << '\n';
+		}
+		os << n << "_sum " << t.sum[i] << '\n';
+		os << n << "_count " << c << '\n';
+	}
+}
+
+} // namespace
+
+void * StatSlot::operator new(size_t n)
+{
+	void * p;
+	if (posix_memalign(&p,alignof(StatSlot),n)) throw std::bad_alloc();
+	return p;
+}
+
+void StatSlot::operator delete(void * p) noexcept
+{
+	std::free(p);
+}
+
+#ifdef LOCN_STATS
+thread_local StatSlot * stat_tls = 0;
+
+StatSlot * stat_new()
+{
+	std::lock_guard<std::mutex> lk(slots_m);
+	slots.emplace_back(new StatSlot());
+	return slots.back().get();
+}
+#endif
+
+void stat_dump(std::ostream & os, StatFormat f)
+{
+	Snapshot t;
+	std::vector<Snapshot> ts;
+	{
+		std::lock_guard<std::mutex> lk(slots_m);
+		ts.resize(slots.size());
+		for (size_t k = 0; k<slots.size(); k++) {
+			ts[k].add(*slots[k]);
+			t.add(*slots[k]);
+		}
+	}
+	if (f==St_Prometheus) dump_prometheus(os,t);
+	else dump_json(os,t,ts);
+}
+
+void stat_save(std::string const & fn, StatFormat f)
+{
+	if (fn=="-") {
+		stat_dump(std::cerr,f);
+		return;
+	}
+	// write aside and rename, so that readers never see a partial file
+	std::string tn = fn+".tmp";
+	{
+		std::ofstream os(tn);
+		if (!os) error("Unable to create "+tn);
+		stat_dump(os,f);
+		if (!os.flush()) error("Unable to write "+tn);
+	}
+	if (std::rename(tn.c_str(),fn.c_str())) error("Unable to rename "+tn+" to "+fn);
+}
+
+StatReporter::StatReporter(std::string const & fn, StatFormat f, double s)
+: fn(fn), f(f)
+{
+	th = std::thread([this,s] {
+		auto d = std::chrono::duration<double>(s);
+		std::unique_lock<std::mutex> lk(m);
+		while (!cv.wait_for(lk,d,[this]{return stop;})) {
+			try {
+				stat_save(this->fn,this->f);
+			}
+			catch (Error & e) { // try again next time, a failure at the end is reported
+			}
+		}
+	});
+}
+
+StatReporter::~StatReporter()
+{
+	{
+		std::lock_guard<std::mutex> lk(m);
+		stop = true;
+	}
+	cv.notify_all();
+	th.join();
+}
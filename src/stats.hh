@@ -0,0 +1,163 @@
+/**\file
+   \brief Counters, timers and histograms of a run
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Each thread records into a slot of its own, created on first
+   use and kept to the end of the run, so recording takes no lock and
+   shares no cache line with other threads.  Only the owning thread
+   writes a slot, with relaxed atomic stores that compile to plain
+   moves, and a dump may read all slots at any time.  Without
+   LOCN_STATS defined, recording compiles to nothing.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Counted events
+enum StatCount {
+	St_Frames, ///<images processed
+	St_Candidates, ///<local maxima above the threshold
+	St_Accepted, ///<fits kept as localizations
+	St_Rejected, ///<fits left out by the outlier filters
+	St_MaxIter, ///<fits stopped by the iteration limit
+	St_Warm, ///<fits started from a particle of the previous frame
+	St_Counts ///<number of counters
+};
+
+/// Timed stages
+enum StatTime {
+	St_Read, ///<reading and decoding frames
+	St_Background, ///<updating the temporal background
+	St_Convert, ///<conversion of raw counts to photons
+	St_Filter, ///<wavelet filter
+	St_Detect, ///<finding candidates
+	St_Fit, ///<fitting candidates
+	St_Write, ///<writing localizations
+	St_Times ///<number of timers
+};
+
+/// Histograms of per-fit values
+enum StatHist {
+	St_Iterations, ///<iterations of the minimizer
+	St_Evaluations, ///<likelihood evaluations
+	St_Hists ///<number of histograms
+};
+
+/// Format of a dump
+enum StatFormat {
+	St_JSON, ///<JSON object with totals and per-thread values
+	St_Prometheus ///<Prometheus text exposition of the totals
+};
+
+int const stat_bins = 16; ///<histogram bins, bin b for values up to 2^b and the last for the rest
+
+/// Statistics recorded by one thread, on cache lines of its own
+struct alignas(64) StatSlot
+{
+	std::atomic<uint64_t> cnt[St_Counts]; ///<counters
+	std::atomic<uint64_t> ns[St_Times]; ///<nanoseconds in the stages
+	std::atomic<uint64_t> hist[St_Hists][stat_bins]; ///<histogram bins
+	std::atomic<uint64_t> sum[St_Hists]; ///<sums of the histogrammed values
+
+	static void * operator new(size_t n); ///<allocate aligned to a cache line, which plain new does not do before C++17
+	static void operator delete(void * p) noexcept; ///<release memory from operator new
+};
+
+#ifdef LOCN_STATS
+extern thread_local StatSlot * stat_tls; ///<slot of this thread, null before first use
+StatSlot * stat_new(); ///<\return new slot registered for dumps
+
+/// Slot of the calling thread
+inline StatSlot & stat_slot()
+{
+	if (!stat_tls) stat_tls = stat_new();
+	return *stat_tls;
+}
+
+/// Add to a value owned by the calling thread
+inline void stat_inc(std::atomic<uint64_t> & a, uint64_t n)
+{
+	a.store(a.load(std::memory_order_relaxed)+n,std::memory_order_relaxed);
+}
+
+/// Count events
+inline void stat_add(StatCount c, uint64_t n = 1) {stat_inc(stat_slot().cnt[c],n);}
+
+/// Add time spent in a stage
+inline void stat_time(StatTime t, std::chrono::steady_clock::duration d)
+{
+	stat_inc(stat_slot().ns[t],std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+/// Add a value to a histogram
+inline void stat_hist(StatHist h, uint64_t v)
+{
+	int b = 0;
+	while (b<stat_bins-1 && v>(uint64_t(1)<<b)) b ++;
+	auto & s = stat_slot();
+	stat_inc(s.hist[h][b],1);
+	stat_inc(s.sum[h],v);
+}
+
+/// Timer adding the time of its scope to a stage
+class StatTimer
+{
+	StatTime t; ///<timed stage
+	std::chrono::steady_clock::time_point t0; ///<start of the scope
+public:
+	StatTimer(StatTime t) : t(t), t0(std::chrono::steady_clock::now()) {}
+	~StatTimer() {stat_time(t,std::chrono::steady_clock::now()-t0);}
+};
+#else
+inline void stat_add(StatCount, uint64_t = 1) {}
+inline void stat_time(StatTime, std::chrono::steady_clock::duration) {}
+inline void stat_hist(StatHist, uint64_t) {}
+/// Timer doing nothing
+struct StatTimer
+{
+	StatTimer(StatTime) {}
+};
+#endif
+
+bool const stat_enabled = ///<statistics compiled in?
+#ifdef LOCN_STATS
+	true;
+#else
+	false;
+#endif
+
+/// Write the statistics of all threads so far
+extern void stat_dump(
+	std::ostream & os, ///<output stream
+	StatFormat f ///<format of the output
+);
+
+/// Write the statistics to a file, replacing it only when complete
+extern void stat_save(
+	std::string const & fn, ///<filename, - for the standard error
+	StatFormat f ///<format of the output
+);
+
+/// Thread saving the statistics periodically while it exists
+class StatReporter
+{
+	std::string fn; ///<output filename
+	StatFormat f; ///<format of the output
+	std::mutex m; ///<lock for stop
+	std::condition_variable cv; ///<signaled on stop
+	bool stop = false; ///<reporter is being destroyed
+	std::thread th; ///<saving thread
+public:
+	/// Start saving
+	StatReporter(
+		std::string const & fn, ///<filename, - for the standard error
+		StatFormat f, ///<format of the output
+		double s ///<seconds between saves
+	);
+	~StatReporter(); ///<stop saving, without a final save
+};
@@ -0,0 +1,128 @@
+/**\file
+   \brief Thread pool with work stealing for indexed tasks
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "steal_pool.hh"
+
+StealPool::StealPool(int n)
+{
+	if (n<1) n = 1;
+	for (int k = 0; k<n; k++) rs.emplace_back(new Range);
+	for (int k = 1; k<n; k++) ts.emplace_back(&StealPool::loop,this,k);
+}
+
+StealPool::~StealPool()
+{
+	{
+		std::lock_guard<std::mutex> lk(m);
+		stop = true;
+		cv_start.notify_all();
+	}
+	for (auto & t: ts) t.join();
+}
+
+bool StealPool::take(int k, size_t & i)
+{
+	auto & r = *rs[k];
+	{
+		std::lock_guard<std::mutex> lk(r.m);
+		if (r.b<r.e) {
+			i = r.b++;
+			return true;
+		}
+	}
+	// own range exhausted, steal from the victim with most remaining
+	for (;;) {
+		int v = -1;
+		size_t mx = 0;
+		for (int j = 0; j<size(); j++) {
+			if (j==k) continue;
+			auto & o = *rs[j];
+			std::lock_guard<std::mutex> lk(o.m);
+			if (o.e-o.b>mx) {
+				mx = o.e-o.b;
+				v = j;
+			}
+		}
+		if (v<0) return false;
+		size_t b, e;
+		{
+			auto & o = *rs[v];
+			std::lock_guard<std::mutex> lk(o.m);
+			if (o.b>=o.e) continue; // drained meanwhile, look again
+			e = o.e;
+			b = o.e-(o.e-o.b+1)/2;
+			o.e = b;
+		}
+		i = b;
+		std::lock_guard<std::mutex> lk(r.m);
+		r.b = b+1;
+		r.e = e;
+		return true;
+	}
+}
+
+void StealPool::work(int k, task_t const & f)
+{
+	size_t i;
+	try {
+		while (take(k,i)) f(k,i);
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> lk(m);
+		if (!err) err = std::current_exception();
+		// drop all remaining tasks
+		for (auto & r: rs) {
+			std::lock_guard<std::mutex> lr(r->m);
+			r->b = r->e;
+		}
+	}
+}
+
+void StealPool::loop(int k)
+{
+	unsigned g = 0;
+	for (;;) {
+		task_t const * f;
+		{
+			std::unique_lock<std::mutex> lk(m);
+			cv_start.wait(lk,[&]{return stop || gen!=g;});
+			if (stop) return;
+			g = gen;
+			f = job;
+		}
+		work(k,*f);
+		std::lock_guard<std::mutex> lk(m);
+		if (--active==0) cv_end.notify_all();
+	}
+}
+
+void StealPool::run(size_t n, task_t const & f)
+{
+	std::unique_lock<std::mutex> lb(busy,std::try_to_lock);
+	if (!lb || size()==1) { // pool in use or no helpers, do it alone
+		for (size_t i = 0; i<n; i++) f(0,i);
+		return;
+	}
+	// split the tasks evenly among the workers
+	int nw = size();
+	for (int k = 0; k<nw; k++) {
+		auto & r = *rs[k];
+		std::lock_guard<std::mutex> lk(r.m);
+		r.b = n*k/nw;
+		r.e = n*(k+1)/nw;
+	}
+	{
+		std::lock_guard<std::mutex> lk(m);
+		job = &f;
+		err = nullptr;
+		active = nw-1;
+		gen ++;
+		cv_start.notify_all();
+	}
+	work(0,f);
+	std::unique_lock<std::mutex> lk(m);
+	cv_end.wait(lk,[this]{return active==0;});
+	job = 0;
+	if (err) std::rethrow_exception(err);
+}
@@ -0,0 +1,60 @@
+/**\file
+   \brief Thread pool with work stealing for indexed tasks
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+*/
+#pragma once
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <vector>
+
+/// Thread pool running indexed tasks with work stealing
+/**
+   The index range of a job is split evenly among the workers.  Each worker
+   takes tasks from the front of its own range, and when that runs dry
+   steals the back half of the largest remaining range of another worker.
+   The calling thread takes part as worker 0.  When the pool is already
+   busy with a job from another thread, the caller runs its job alone, so
+   nested use from several threads never blocks.
+*/
+class StealPool
+{
+public:
+	typedef std::function<void(int,size_t)> task_t; ///<task taking worker number and task index
+private:
+	/// Range of task indices owned by a worker
+	struct Range
+	{
+		std::mutex m; ///<lock for the range
+		size_t b = 0; ///<first index not yet taken
+		size_t e = 0; ///<end of the range
+	};
+	std::vector<std::unique_ptr<Range> > rs; ///<ranges for all workers
+	std::vector<std::thread> ts; ///<pool threads (workers 1 and above)
+	std::mutex busy; ///<held while a job runs
+	std::mutex m; ///<lock for the job state below
+	std::condition_variable cv_start; ///<signaled when a job starts or pool stops
+	std::condition_variable cv_end; ///<signaled when a worker finishes a job
+	task_t const * job = 0; ///<current job
+	unsigned gen = 0; ///<job generation
+	int active = 0; ///<number of pool threads still working on the job
+	bool stop = false; ///<pool is shutting down
+	std::exception_ptr err; ///<first exception thrown by a task
+	bool take(int k, size_t & i); ///<take next task for worker k
+	void work(int k, task_t const & f); ///<run tasks as worker k
+	void loop(int k); ///<main loop of a pool thread
+public:
+	/// Create pool with given number of workers
+	StealPool(int n ///<number of workers, including the calling thread
+	);
+	~StealPool();
+	int size() const {return rs.size();} ///<\return number of workers
+	/// Run f(worker,i) for all i in [0,n), returning when all are done
+	void run(
+		size_t n, ///<number of tasks
+		task_t const & f ///<task function
+	);
+};
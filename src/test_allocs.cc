@@ -0,0 +1,78 @@
+/**\file
+   \brief Test that localizing frames allocates nothing after the first
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Heap allocations are counted through the global operator new
+   while synthetic frames of one size go through calibration and
+   process_image with a FrameWorkspace kept between frames, as a worker of
+   loc1 does.  Every estimator runs in both precisions, with and without a
+   readout variance and warm starts.  Any allocation after the first frame
+   of a run fails the test.  Fitting runs serially, as the stats slots of
+   pool threads are made whenever a thread first fits.
+*/
+#include "calib.hh"
+#include "locate.hh"
+#include "simulate.hh"
+#include "utils.hh"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+std::atomic<size_t> allocs(0); ///<heap allocations so far, in all threads
+
+/// Allocate with counting
+void * operator new(size_t n)
+{
+	allocs.fetch_add(1,std::memory_order_relaxed);
+	if (void * p = std::malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void * p) noexcept {std::free(p);} ///<release memory from operator new
+void operator delete(void * p, size_t) noexcept {std::free(p);} ///<release memory from operator new
+
+/// Localize the frames with one workspace
+template<typename T>
+size_t run(LocSettings const & cs, Calibration const & cal, std::vector<std::vector<uint16_t> > const & fs, int w, int h, bool warm)
+{
+	FrameWorkspace<T> wk;
+	std::vector<Particle> ps;
+	WarmStart ws;
+	size_t n = 0; // allocations after the first frame
+	for (size_t k = 0; k<fs.size(); k++) {
+		size_t a = allocs;
+		T * im = wk.images(w,h);
+		cal.apply(fs[k].data(),false,w,h,im,im+size_t(w)*h);
+		process_image(cs,im,im+size_t(w)*h,cal.variance(w,h,wk.var),w,h,wk,ps,0,0,warm ? &ws : 0,k);
+		if (k) n += allocs-a;
+	}
+	return n;
+}
+
+int main()
+{
+	int const w = 128;
+	int const h = 96;
+	SimParams sp;
+	sp.density = 2;
+	Simulator sim(sp,w,h,1);
+	std::vector<std::vector<uint16_t> > fs(6);
+	for (size_t k = 0; k<fs.size(); k++) sim.frame(fs[k],k+1);
+	int fail = 0;
+	for (int v = 0; v<2; v++) {
+		Calibration cal;
+		cal.set(Calibration::Cal_Offset,std::to_string(sp.offset));
+		cal.set(Calibration::Cal_Gain,std::to_string(sp.gain));
+		if (v) cal.set(Calibration::Cal_Variance,"2");
+		for (auto e: {Est_NM,Est_LM,Est_LMB}) for (int warm = 0; warm<2; warm++) for (int sg = 0; sg<2; sg++) {
+			LocSettings cs;
+			cs.estimator = e;
+			size_t n = sg ? run<float>(cs,cal,fs,w,h,warm) : run<double>(cs,cal,fs,w,h,warm);
+			if (!n) continue;
+			msg(0) << "estimator " << e << (sg ? " float" : " double") << (warm ? " warm" : "") << (v ? " variance" : "");
+			msg(0) << ": " << n << " allocations after the first frame\n";
+			fail = 1;
+		}
+	}
+	return fail;
+}
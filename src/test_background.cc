@@ -0,0 +1,70 @@
+/**\file
+   \brief Test of the running quantile of Background against brute force
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Random frames with few distinct values, so that ties are
+   common, are added to windows of 1 to 6 frames with a quantile for every
+   rank of the full window, and each output is compared with the sorted
+   values of the frames in the window.  Since every rank is read off, the
+   sorted arrays must hold exactly the values of the ring.  Frames are
+   added with and without byte swapping and with a thread pool, and the
+   frame size changes midway to restart the windows.
+*/
+#include "background.hh"
+#include "steal_pool.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cstdlib>
+#include <ostream>
+#include <random>
+#include <vector>
+
+int main()
+{
+	std::mt19937_64 rng(1);
+	StealPool pool(3);
+	int fails = 0;
+	for (int k = 1; k<=6; k++) for (int ip = 0; ip<2; ip++) {
+		std::vector<double> qs; // quantiles reading every rank of the full window
+		for (int i = 0; i<k; i++) qs.push_back(k>1 ? double(i)/(k-1) : 0.5);
+		qs.push_back(0.3);
+		std::vector<Background> bs;
+		for (double q: qs) bs.emplace_back(k,q);
+		if (ip) for (auto & b: bs) b.set_pool(&pool);
+		std::vector<std::vector<uint16_t> > past; // frames in the window, oldest first
+		int w = 0;
+		int h = 0;
+		for (int f = 0; f<40; f++) {
+			if (f%20==0) { // new size, restarting the windows
+				w = 17+f;
+				h = 9+f/2;
+				past.clear();
+			}
+			size_t sz = size_t(w)*h;
+			std::vector<uint16_t> v(sz);
+			int nv = f%3 ? 5 : 60000; // distinct values
+			for (auto & x: v) x = uint16_t(rng()%nv*(nv<10 ? 1000 : 1)+(nv<10 ? 255 : 0));
+			bool swap = f%2;
+			std::vector<uint16_t> in = v; // as given to add
+			if (swap) for (auto & x: in) x = uint16_t(x<<8|x>>8);
+			past.push_back(v);
+			if (int(past.size())>k) past.erase(past.begin());
+			int m = past.size();
+			std::vector<uint16_t> bg(sz);
+			std::vector<uint16_t> s(m);
+			for (size_t b = 0; b<bs.size(); b++) {
+				bs[b].add(in.data(),swap,w,h,bg.data());
+				int j = int(qs[b]*(m-1)+.5);
+				for (size_t i = 0; i<sz; i++) {
+					for (int t = 0; t<m; t++) s[t] = past[t][i];
+					std::sort(s.begin(),s.end());
+					if (bg[i]==s[j]) continue;
+					msg(0) << "failed: k " << k << " q " << qs[b] << (ip ? " with pool" : "") << " frame " << f;
+					msg(0) << " pixel " << i << ": " << bg[i] << " instead of " << s[j] << '\n';
+					fails ++;
+					break;
+				}
+			}
+		}
+	}
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
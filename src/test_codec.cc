@@ -0,0 +1,390 @@
+/**\file
+   \brief Fixture tests of the TIFF strip decoders
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details The PackBits fixture is the example of the TIFF 6.0
+   specification, and the short LZW fixture is worked out by hand from the
+   specification, including a code that refers to the entry being made.
+   Longer LZW streams come from an encoder written here after tif_lzw.c of
+   libtiff, with the early change of the code width at 511, 1023 and 2047
+   entries and a clear code when the table is full, and also without the
+   clear code so that the table stays full.  Deflate strips come from
+   zlib.  Whole frames of 16-bit samples with the horizontal predictor are
+   written in both byte orders and read back through Tiff.
+
+   Compressed data is placed right before a page without access, and so
+   is the output buffer, so that reading or writing past either ends the
+   test with a fault.  Every truncation of the fixtures must decode to a part of the output,
+   and Tiff must raise an error for truncated or corrupt strips.
+*/
+#include "codec.hh"
+#include "tiff.hh"
+#include "utils.hh"
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+int fails = 0; ///<number of failed checks
+
+/// Count a failed check
+void check(bool ok, std::string const & what)
+{
+	if (ok) return;
+	msg(0) << "failed: " << what << '\n';
+	fails ++;
+}
+
+/// Memory ending right before a page without access
+class Fence
+{
+	char * b; ///<mapping
+	size_t z; ///<size of the mapping
+	size_t a; ///<size of the accessible part
+public:
+	/// Map room for n bytes
+	Fence(size_t n)
+	{
+		size_t pg = sysconf(_SC_PAGESIZE);
+		a = (n+pg-1)/pg*pg;
+		z = a+pg;
+		void * m = mmap(0,z,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if (m==MAP_FAILED) error("Unable to map memory");
+		b = static_cast<char *>(m);
+		mprotect(b+a,pg,PROT_NONE);
+	}
+	~Fence() {munmap(b,z);}
+	char * end() {return b+a;} ///<\return the first byte without access
+	/// Copy data to end right at the fence
+	char const * put(std::string const & s) ///<\return start of the copy
+	{
+		char * p = end()-s.size();
+		memcpy(p,s.data(),s.size());
+		return p;
+	}
+};
+
+/// Decoder of a strip
+typedef size_t (* dec_t)(char const *, size_t, char *, size_t);
+
+/// Decode with input and output against fences
+std::string decode(dec_t dec, std::string const & in, size_t m)
+{
+	Fence fi(in.size());
+	Fence fo(m);
+	char * o = fo.end()-m;
+	size_t n = dec(fi.put(in),in.size(),o,m);
+	return std::string(o,n);
+}
+
+/// Decoding of each truncation of in gives a part of the expected output
+/** The output is complete only if no more than the end code or checksum is cut. */
+void truncations(dec_t dec, std::string const & in, std::string const & ex, std::string const & what, size_t step = 1)
+{
+	for (size_t n = 0; n<in.size(); n += step) {
+		std::string r = decode(dec,in.substr(0,n),ex.size());
+		if (r.size()>ex.size() || ex.compare(0,r.size(),r) || (r.size()==ex.size() && n+4<in.size())) {
+			check(false,what+" cut to "+std::to_string(n)+" bytes");
+			return;
+		}
+	}
+}
+
+/// LZW encoder after libtiff
+struct LZWEncoder
+{
+	bool clear_full = true; ///<emit a clear code when the table is full
+	bool widths[13] = {}; ///<code widths used
+	int clears = 0; ///<clear codes emitted after the first
+	/// Encode s
+	std::string operator()(std::string const & s)
+	{
+		std::string r;
+		uint64_t bits = 0;
+		int nb = 0;
+		int width = 9;
+		auto put = [&](int c) {
+			bits = bits<<width|c;
+			nb += width;
+			widths[width] = true;
+			while (nb>=8) {
+				r += char(bits>>(nb-8));
+				nb -= 8;
+			}
+		};
+		std::vector<int> tab(4096*256,-1); // code of string of code p followed by byte k at p*256+k
+		int next = 258;
+		put(256);
+		int w = -1; // code of the string so far
+		for (unsigned char k: s) {
+			if (w<0) {
+				w = k;
+				continue;
+			}
+			int & t = tab[w*256+k];
+			if (t>=0) {
+				w = t;
+				continue;
+			}
+			put(w);
+			if (next<4096) t = next++;
+			if (next==4094 && clear_full) {
+				put(256);
+				clears ++;
+				std::fill(tab.begin(),tab.end(),-1);
+				next = 258;
+				width = 9;
+			}
+			else if (next==(1<<width) && width<12) width ++;
+			w = k;
+		}
+		if (w>=0) put(w);
+		put(257);
+		if (nb) r += char(bits<<(8-nb));
+		return r;
+	}
+};
+
+/// PackBits encoder with literal runs and repeats
+std::string pack_bits(std::string const & s)
+{
+	std::string r;
+	size_t i = 0;
+	while (i<s.size()) {
+		size_t j = i+1;
+		while (j<s.size() && j-i<128 && s[j]==s[i]) j ++;
+		if (j-i>=3) {
+			r += char(1-int(j-i));
+			r += s[i];
+			i = j;
+			continue;
+		}
+		j = i;
+		while (j<s.size() && j-i<128 && !(j+2<s.size() && s[j]==s[j+1] && s[j]==s[j+2])) j ++;
+		r += char(j-i-1);
+		r.append(s,i,j-i);
+		i = j;
+	}
+	return r;
+}
+
+/// Deflate with zlib
+std::string deflate(std::string const & s)
+{
+	uLongf n = compressBound(s.size());
+	std::string r(n,0);
+	compress2(reinterpret_cast<Bytef *>(&r[0]),&n,reinterpret_cast<Bytef const *>(s.data()),s.size(),6);
+	r.resize(n);
+	return r;
+}
+
+/// Bytes of samples like those of a camera, with runs and repeated rows
+std::string samples(size_t n, uint64_t seed)
+{
+	std::mt19937_64 rng(seed);
+	std::string r(2*n,0);
+	for (size_t i = 0; i<n; i++) {
+		uint16_t v = i%700<300 ? uint16_t(100+rng()%8) : uint16_t(i%96<40 ? 4000 : rng());
+		if (i>=256 && i%1024<256) v = uint16_t(uint8_t(r[2*(i-256)])|uint8_t(r[2*(i-256)+1])<<8); // repeat the row before
+		r[2*i] = char(v);
+		r[2*i+1] = char(v>>8);
+	}
+	return r;
+}
+
+/// TIFF of one frame of 16-bit samples
+std::string tiff(std::vector<uint16_t> const & v, int w, int h, int rps, uint16_t cmp, bool pred, bool big_endian)
+{
+	auto b16 = [&](std::string & s, uint32_t x) {
+		if (big_endian) s += char(x>>8), s += char(x);
+		else s += char(x), s += char(x>>8);
+	};
+	auto b32 = [&](std::string & s, uint32_t x) {
+		if (big_endian) b16(s,x>>16), b16(s,x);
+		else b16(s,x), b16(s,x>>16);
+	};
+	std::string r = big_endian ? "MM" : "II";
+	b16(r,42);
+	b32(r,0); // IFD offset, set below
+	std::vector<uint32_t> so;
+	std::vector<uint32_t> sc;
+	for (int y0 = 0; y0<h; y0 += rps) {
+		std::string s;
+		for (int y = y0; y<std::min(h,y0+rps); y++) for (int x = 0; x<w; x++) {
+			uint16_t a = v[y*w+x];
+			if (pred && x) a = uint16_t(a-v[y*w+x-1]);
+			b16(s,a);
+		}
+		if (cmp==Tiff::Cmp_LZW) s = LZWEncoder()(s);
+		else if (cmp==Tiff::Cmp_PackBits) s = pack_bits(s);
+		else if (cmp==Tiff::Cmp_Deflate) s = deflate(s);
+		if (r.size()%2) r += '\0';
+		so.push_back(r.size());
+		sc.push_back(s.size());
+		r += s;
+	}
+	size_t ns = so.size();
+	auto array = [&](std::vector<uint32_t> const & a) { // offset of the array written after the strips
+		if (r.size()%2) r += '\0';
+		uint32_t o = r.size();
+		for (auto x: a) b32(r,x);
+		return o;
+	};
+	uint32_t ao = ns>1 ? array(so) : so[0];
+	uint32_t ac = ns>1 ? array(sc) : sc[0];
+	if (r.size()%2) r += '\0';
+	std::string hd;
+	uint32_t io = r.size();
+	b32(hd,io);
+	r.replace(4,4,hd);
+	struct E {uint16_t t, y; uint32_t n, v;};
+	std::vector<E> es = {
+		{256,4,1,uint32_t(w)},{257,4,1,uint32_t(h)},{258,3,1,16},{259,3,1,cmp},{262,3,1,1},
+		{273,4,uint32_t(ns),ao},{277,3,1,1},{278,4,1,uint32_t(rps)},{279,4,uint32_t(ns),ac},{317,3,1,pred ? 2u : 1u}
+	};
+	b16(r,es.size());
+	for (auto & e: es) {
+		b16(r,e.t);
+		b16(r,e.y);
+		b32(r,e.n);
+		if (e.y==3) {
+			b16(r,e.v);
+			b16(r,0);
+		}
+		else b32(r,e.v);
+	}
+	b32(r,0);
+	return r;
+}
+
+/// 32-bit value at position i of s
+uint32_t get32(std::string const & s, size_t i, bool big_endian)
+{
+	uint32_t r = 0;
+	for (int k = 0; k<4; k++) r |= uint32_t(uint8_t(s[i+k]))<<(big_endian ? 24-8*k : 8*k);
+	return r;
+}
+
+/// Position of the value of the StripByteCounts entry in a TIFF from tiff()
+size_t count_entry(std::string const & s)
+{
+	bool be = s[0]=='M';
+	size_t o = get32(s,4,be);
+	return o+2+8*12+8; // the ninth entry after the entry count
+}
+
+/// Read frame 0 of a TIFF in memory
+std::vector<uint16_t> read(std::string const & s)
+{
+	std::istringstream is(s);
+	Tiff tf(is);
+	tf.start();
+	std::vector<uint16_t> b;
+	auto f = tf.scan(0);
+	if (!f) error("No frame");
+	auto p = tf.frame(0,b);
+	return std::vector<uint16_t>(p,p+size_t(f->image_width)*f->image_length);
+}
+
+/// Reading s raises an error
+bool fails_to_read(std::string const & s)
+{
+	try {
+		read(s);
+	}
+	catch (Error & e) {
+		return true;
+	}
+	return false;
+}
+
+void test_packbits()
+{
+	// example of the TIFF 6.0 specification, section 9
+	std::string in("\xfe\xaa\x02\x80\x00\x2a\xfd\xaa\x03\x80\x00\x2a\x22\xf7\xaa",15);
+	std::string ex("\xaa\xaa\xaa\x80\x00\x2a\xaa\xaa\xaa\xaa\x80\x00\x2a\x22\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa",24);
+	check(decode(unpack_bits,in,ex.size())==ex,"PackBits fixture");
+	check(decode(unpack_bits,std::string("\x80",1)+in,ex.size())==ex,"PackBits no-op byte");
+	check(decode(unpack_bits,in,10)==ex.substr(0,10),"PackBits into short output");
+	truncations(unpack_bits,in,ex,"PackBits fixture");
+	// runs of all lengths
+	std::string s;
+	for (int l = 1; l<=130; l++) s += std::string(l,char(l)) + "xyz";
+	std::string p = pack_bits(s);
+	check(decode(unpack_bits,p,s.size())==s,"PackBits runs");
+	truncations(unpack_bits,p,s,"PackBits runs");
+}
+
+void test_lzw()
+{
+	// ABABABA: codes clear, A, B, 258 (AB), 260 (ABA, the entry being made), end
+	std::string in("\x80\x10\x48\x50\x28\x24\x04",7);
+	check(decode(lzw_decode,in,7)=="ABABABA","LZW fixture");
+	check(decode(lzw_decode,in,5)=="ABABA","LZW fixture into short output");
+	truncations(lzw_decode,in,"ABABABA","LZW fixture");
+	check(decode(lzw_decode,std::string("\x80\x10\x65\x90\x10",5),7)=="A","LZW code beyond the table"); // clear, A, 300, end
+	std::string s = samples(40000,1);
+	for (int cf = 1; cf>=0; cf--) {
+		LZWEncoder enc;
+		enc.clear_full = cf;
+		std::string z = enc(s);
+		std::string what = cf ? "LZW with clear codes" : "LZW with full table";
+		check(enc.widths[9] && enc.widths[10] && enc.widths[11] && enc.widths[12],what+" uses codes of 9 to 12 bits");
+		check(!cf || enc.clears>0,what+" clears the table");
+		check(decode(lzw_decode,z,s.size())==s,what);
+		truncations(lzw_decode,z,s,what,97);
+		std::string c = z;
+		for (size_t i = 100; i<c.size(); i += 997) c[i] = char(~c[i]); // corrupt, decoding ends anywhere
+		decode(lzw_decode,c,s.size());
+	}
+}
+
+void test_deflate()
+{
+	std::string s = samples(20000,2);
+	std::string z = deflate(s);
+	check(decode(inflate_strip,z,s.size())==s,"Deflate");
+	truncations(inflate_strip,z,s,"Deflate",31);
+}
+
+void test_tiff()
+{
+	int const w = 37;
+	int const h = 29;
+	std::mt19937_64 rng(3);
+	std::vector<uint16_t> v(w*h);
+	for (auto & x: v) x = uint16_t(rng()%3==0 ? rng() : 0x1234+rng()%300);
+	for (uint16_t cmp: {Tiff::Cmp_LZW,Tiff::Cmp_PackBits,Tiff::Cmp_Deflate}) for (int pred = 0; pred<2; pred++) for (int be = 0; be<2; be++) {
+		std::string what = "TIFF compression "+std::to_string(cmp)+(pred ? " with predictor" : "")+(be ? " big-endian" : " little-endian");
+		std::string t = tiff(v,w,h,8,cmp,pred,be);
+		check(read(t)==v,what);
+		// one strip right after the header, cut short or corrupt
+		std::string cut = tiff(v,w,h,h,cmp,pred,be);
+		size_t at = count_entry(cut);
+		uint32_t n = get32(cut,at,be);
+		for (int k = 0; k<4; k++) cut[at+k] = char(be ? n/2>>(24-8*k) : n/2>>(8*k));
+		check(fails_to_read(cut),what+" truncated strip");
+		if (cmp==Tiff::Cmp_PackBits) continue; // any bytes are valid PackBits
+		std::string bad = tiff(v,w,h,h,cmp,pred,be);
+		for (size_t i = 8; i<24; i++) bad[i] = char(0xff);
+		check(fails_to_read(bad),what+" corrupt strip");
+	}
+}
+
+int main()
+{
+	try {
+		test_packbits();
+		test_lzw();
+		test_deflate();
+		test_tiff();
+	}
+	catch (Error & e) {
+		msg(0) << "Error: " << e.msg << '\n';
+		return EXIT_FAILURE;
+	}
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
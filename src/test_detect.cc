@@ -0,0 +1,79 @@
+/**\file
+   \brief Test of find_maxima against a direct reading of its rule
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Random images of a few distinct values, so that neighbours
+   often tie, with some NaN pixels and some plateaus of equal values, go
+   through find_maxima at every SIMD level in both precisions.  The
+   candidates must be the pixels away from the border that are above the
+   threshold, higher than the neighbours east, south-east, south and
+   south-west, and not lower than the other four, in increasing order.
+   A NaN pixel is never a candidate; a NaN neighbour blocks a candidate
+   on the first four sides only, as a comparison with NaN is false.
+*/
+#include "detect.hh"
+#include "wavelet.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <ostream>
+#include <random>
+#include <vector>
+
+/// Candidates by the rule, pixel by pixel
+template<typename T>
+std::vector<int> reference(std::vector<T> const & f, int w, int h, int r, T t)
+{
+	std::vector<int> c;
+	for (int y = r; y<h-r; y++) for (int x = r; x<w-r; x++) {
+		int i = y*w+x;
+		T v = f[i];
+		if (!(v>t)) continue;
+		if (!(v>f[i+1] && v>f[i+w+1] && v>f[i+w] && v>f[i+w-1])) continue; // E, SE, S, SW
+		if (f[i-1]>v || f[i-w-1]>v || f[i-w]>v || f[i-w+1]>v) continue; // W, NW, N, NE
+		c.push_back(i);
+	}
+	return c;
+}
+
+/// Compare find_maxima with the reference on random images
+template<typename T>
+int test(std::mt19937_64 & rng, int n)
+{
+	int fails = 0;
+	std::vector<int> cand;
+	for (int k = 0; k<n; k++) {
+		int w = 3+rng()%70;
+		int h = 3+rng()%20;
+		int r = 1+rng()%3;
+		int nv = 2+rng()%6; // distinct values
+		std::vector<T> f(size_t(w)*h);
+		for (auto & x: f) x = T(rng()%nv);
+		if (k%3==0) for (int j = 0; j<w*h/10; j++) f[rng()%f.size()] = NAN;
+		if (k%4==0) { // a plateau
+			int x0 = rng()%w;
+			int y0 = rng()%h;
+			for (int y = y0; y<std::min(h,y0+3); y++) for (int x = x0; x<std::min(w,x0+4); x++) f[y*w+x] = T(nv);
+		}
+		T t = k%5==0 ? T(-1) : T(rng()%nv)-T(.5);
+		auto ex = reference(f,w,h,r,t);
+		for (SimdLevel l: {Simd_None,Simd_SSE2,Simd_AVX2}) {
+			if (set_simd_level(l)!=l) continue;
+			find_maxima(f.data(),w,h,r,t,cand);
+			if (cand==ex) continue;
+			msg(0) << "failed: " << (sizeof(T)==4 ? "float" : "double") << " level " << l << " image " << k;
+			msg(0) << " (" << w << 'x' << h << ", r " << r << "): " << cand.size() << " candidates instead of " << ex.size() << '\n';
+			fails ++;
+		}
+	}
+	return fails;
+}
+
+int main()
+{
+	std::mt19937_64 rng(1);
+	SimdLevel l0 = simd_level();
+	int fails = test<float>(rng,3000)+test<double>(rng,3000);
+	set_simd_level(l0);
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/**\file
+   \brief Test of the C interface of the localization library in C99
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details A frame with a few Gaussian spots on a flat background is
+   localized once packed and once inside rows of a wider buffer whose
+   extra pixels are saturated, which must give the same localizations
+   near the spots.  Failures are checked to return -1 with a message from
+   locn_error, and the library must print nothing of its own.
+*/
+#include "locn.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {W = 64, H = 48, S = 80, N = 3}; /* frame size, row stride and number of spots */
+
+static double const sx[N] = {12.3, 40.6, 25.2}; /* spot centers in pixels */
+static double const sy[N] = {10.7, 20.4, 36.9};
+
+/** Localizations received by the callback */
+typedef struct
+{
+	locn_loc ls[64]; /**<localizations */
+	size_t n; /**<number of localizations */
+	int calls; /**<number of calls */
+} Found;
+
+static void take(locn_loc const * ls, size_t n, void * user)
+{
+	Found * f = user;
+	f->calls ++;
+	for (size_t i = 0; i<n && f->n<64; i++) f->ls[f->n++] = ls[i];
+}
+
+static int fails = 0;
+
+static void check(int ok, char const * what)
+{
+	if (ok) return;
+	printf("failed: %s\n", what);
+	fails ++;
+}
+
+int main(void)
+{
+	uint16_t * packed = malloc(sizeof(uint16_t)*W*H);
+	uint16_t * wide = malloc(sizeof(uint16_t)*S*H);
+	for (int y = 0; y<H; y++) for (int x = 0; x<S; x++) {
+		double mu = 50; /* photons, with gain 2 and offset 100 */
+		for (int k = 0; k<N; k++) {
+			double dx = x-sx[k];
+			double dy = y-sy[k];
+			mu += 3000/(2*M_PI*1.5*1.5)*exp(-(dx*dx+dy*dy)/(2*1.5*1.5));
+		}
+		uint16_t v = (uint16_t)(100+mu/2+.5);
+		wide[y*S+x] = x<W ? v : 65535;
+		if (x<W) packed[y*W+x] = v;
+	}
+
+	locn_localizer * lc = locn_create();
+	check(lc!=NULL, "locn_create");
+	check(locn_set(lc, "offset", "100")==0, "locn_set offset");
+	check(locn_set(lc, "gain", "2")==0, "locn_set gain");
+	check(locn_set(lc, "estimator", "lm")==0, "locn_set estimator");
+
+	Found a = {{{0}}, 0, 0};
+	Found b = {{{0}}, 0, 0};
+	long na = locn_process_frame(lc, packed, W, H, W, 7, take, &a);
+	long nb = locn_process_frame(lc, wide, W, H, S, 7, take, &b);
+	check(na==N && a.n==N && a.calls==1, "packed frame");
+	check(nb==na && b.n==a.n && b.calls==1, "strided frame");
+	check(!memcmp(a.ls, b.ls, sizeof(locn_loc)*a.n), "strided frame equal to packed");
+	for (int k = 0; k<N; k++) {
+		int near = 0;
+		for (size_t i = 0; i<a.n; i++) {
+			locn_loc const * l = a.ls+i;
+			if (l->frame==7 && fabs(l->x-80*sx[k])<10 && fabs(l->y-80*sy[k])<10) near = 1;
+		}
+		check(near, "localization at spot");
+	}
+
+	check(locn_set(lc, "no-such-setting", "1")==-1, "unknown setting fails");
+	check(strstr(locn_error(), "no-such-setting")!=NULL, "message of unknown setting");
+	check(locn_set(lc, "estimator", "xx")==-1, "unknown estimator fails");
+	check(strstr(locn_error(), "xx")!=NULL, "message of unknown estimator");
+	Found c = {{{0}}, 0, 0};
+	check(locn_process_frame(lc, wide, W, H, W-1, 1, take, &c)==-1, "short stride fails");
+	check(c.calls==0, "no callback on failure");
+	check(strlen(locn_error())>0, "message of short stride");
+
+	locn_destroy(lc);
+	locn_destroy(NULL);
+	free(packed);
+	free(wide);
+	return fails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+/**\file
+   \brief Test that fits of offset-corrected frames with low background are finite
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Synthetic frames with a background of two photons and a read
+   noise of four ADU are calibrated with the camera offset, so that the
+   photon image goes below zero in many fitting windows.  Every estimator
+   in both precisions, with and without warm starts, must give finite
+   parameters for every candidate, and most fits must pass to_loc.
+*/
+#include "calib.hh"
+#include "locate.hh"
+#include "simulate.hh"
+#include "utils.hh"
+#include <cmath>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+
+/// Localize the frames and count the fits that are not finite and those accepted
+template<typename T>
+void run(LocSettings const & cs, Calibration const & cal, std::vector<std::vector<uint16_t> > const & fs, int w, int h, bool warm,
+	size_t & fits, size_t & bad, size_t & good)
+{
+	FrameWorkspace<T> wk;
+	std::vector<Particle> ps;
+	WarmStart ws;
+	for (size_t k = 0; k<fs.size(); k++) {
+		T * im = wk.images(w,h);
+		cal.apply(fs[k].data(),false,w,h,im,im+size_t(w)*h);
+		process_image(cs,im,im+size_t(w)*h,cal.variance(w,h,wk.var),w,h,wk,ps,0,0,warm ? &ws : 0,k);
+		for (auto & r: ps) {
+			fits ++;
+			bool fin = true;
+			for (auto v: r.p) if (!std::isfinite(v)) fin = false;
+			if (!fin) bad ++;
+			Loc l;
+			if (to_loc(r,k+1,80,l,cs.fwr)) good ++;
+		}
+	}
+}
+
+int main()
+{
+	int const w = 128;
+	int const h = 128;
+	SimParams sp;
+	sp.bg = 2;
+	sp.read_noise = 4;
+	Simulator sim(sp,w,h,1);
+	std::vector<std::vector<uint16_t> > fs(10);
+	for (size_t k = 0; k<fs.size(); k++) sim.frame(fs[k],k+1);
+	Calibration cal;
+	cal.set(Calibration::Cal_Offset,std::to_string(sp.offset));
+	int fail = 0;
+	for (auto e: {Est_NM,Est_LM,Est_LMB}) for (int warm = 0; warm<2; warm++) for (int sg = 0; sg<2; sg++) {
+		LocSettings cs;
+		cs.estimator = e;
+		size_t fits = 0;
+		size_t bad = 0;
+		size_t good = 0;
+		if (sg) run<float>(cs,cal,fs,w,h,warm,fits,bad,good);
+		else run<double>(cs,cal,fs,w,h,warm,fits,bad,good);
+		if (fits && !bad && 2*good>fits) continue;
+		msg(0) << "estimator " << e << (sg ? " float" : " double") << (warm ? " warm" : "");
+		msg(0) << ": " << bad << " of " << fits << " fits not finite, " << good << " accepted\n";
+		fail = 1;
+	}
+	return fail;
+}
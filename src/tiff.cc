@@ -1,8 +1,16 @@
 ///\file
 #include "tiff.hh"
 #include "utils.hh"
+#include "codec.hh"
+#include "steal_pool.hh"
 #include <functional>
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -16,52 +24,140 @@ inline void tcheck(Tiff::DEntry const & e, uint16_t t)
 }
 ///@}
 
-uint16_t Tiff::read16()
+uint16_t Tiff::to16(char const * b)
 {
-	union {
-		uint16_t v;
-		char c[2];
-	} b;
-	sp->read(b.c,2);
-	if (efix) {
-		char t = b.c[1];
-		b.c[1] = b.c[0];
-		b.c[0] = t;
+	uint16_t v;
+	memcpy(&v,b,2);
+	return efix ? uint16_t(v<<8|v>>8) : v;
+}
+
+uint32_t Tiff::to32(char const * b)
+{
+	uint32_t v;
+	memcpy(&v,b,4);
+	return efix ? __builtin_bswap32(v) : v;
+}
+
+uint64_t Tiff::to64(char const * b)
+{
+	uint64_t v;
+	memcpy(&v,b,8);
+	return efix ? __builtin_bswap64(v) : v;
+}
+
+Tiff::Tiff(std::string const & fn)
+{
+	if (fn=="-") {
+		is = &std::cin;
+		return;
+	}
+	int fd = open(fn.c_str(),O_RDONLY);
+	if (fd<0) error("Unable to open "+fn);
+	struct stat st;
+	if (fstat(fd,&st)) {
+		close(fd);
+		error("Unable to stat "+fn);
+	}
+	if (!S_ISREG(st.st_mode)) { // pipe or the like, read as it comes
+		close(fd);
+		sp = std::make_shared<std::ifstream>(fn,std::ios::binary);
+		if (!*sp) error("Unable to open "+fn);
+		is = sp.get();
+		return;
+	}
+	msz = st.st_size;
+	void * m = msz ? mmap(0,msz,PROT_READ,MAP_PRIVATE,fd,0) : MAP_FAILED;
+	close(fd);
+	if (m==MAP_FAILED) error("Unable to map "+fn);
+	madvise(m,msz,MADV_SEQUENTIAL);
+	size_t z = msz;
+	mp.reset(static_cast<char const *>(m),[z](char const * p){munmap(const_cast<char *>(p),z);});
+}
+
+void Tiff::stream_to(size_t e)
+{
+	size_t we = wb+win.size(); // current position of stream
+	if (e<=we) return;
+	win.resize(e-wb);
+	is->read(win.data()+(we-wb),e-we);
+	if (!*is) error("Data beyond end of stream");
+	if (win.size()<=wlim) return;
+	// move the older half to the temporary file
+	size_t m = win.size()-wlim/2;
+	if (!spill) {
+		spill.reset(tmpfile(),fclose);
+		if (!spill) error("Unable to create temporary file");
+		sb = wb;
 	}
-	return b.v;
+	size_t z = 0;
+	while (z<m) {
+		ssize_t r = pwrite(fileno(spill.get()),win.data()+z,m-z,wb+z-sb);
+		if (r<=0) error("Unable to write temporary file");
+		z += r;
+	}
+	win.erase(win.begin(),win.begin()+m);
+	wb += m;
 }
 
-uint32_t Tiff::read32()
+void Tiff::release(size_t o)
 {
-	union {
-		uint32_t v;
-		char c[4];
-	} b;
-	sp->read(b.c,4);
-	if (efix) {
-		char t = b.c[3];
-		b.c[3] = b.c[0];
-		b.c[0] = t;
-		t = b.c[2];
-		b.c[2] = b.c[1];
-		b.c[1] = t;
+	if (o<=rel) return;
+	rel = o;
+	if (spill && rel>=wb) { // nothing in the temporary file needed
+		if (ftruncate(fileno(spill.get()),0)) error("Unable to truncate temporary file");
+		spill.reset();
+	}
+	if (rel>wb) {
+		size_t m = std::min(rel-wb,win.size());
+		win.erase(win.begin(),win.begin()+m);
+		wb += m;
 	}
-	return b.v;
 }
 
-Tiff::DEntry Tiff::read_dentry()
+char const * Tiff::fetch(uint64_t o, size_t n)
+{
+	if (mp) {
+		if (o>msz || n>msz-o) error("Data beyond end of file");
+		return mp.get()+o;
+	}
+	if (is) {
+		if (o<rel || (o<wb && (!spill || o<sb))) error("Data before released position of stream");
+		stream_to(size_t(o)+n);
+		if (o>=wb) return win.data()+(o-wb);
+		// partly or wholly in the temporary file
+		fb.resize(n);
+		size_t m = std::min(n,wb-o);
+		size_t z = 0;
+		while (z<m) {
+			ssize_t r = pread(fileno(spill.get()),fb.data()+z,m-z,o+z-sb);
+			if (r<=0) error("Unable to read temporary file");
+			z += r;
+		}
+		memcpy(fb.data()+m,win.data(),n-m);
+		return fb.data();
+	}
+	fb.resize(n);
+	sp->seekg(o);
+	sp->read(fb.data(),n);
+	if (!*sp) error("Unable to read data from file");
+	return fb.data();
+}
+
+Tiff::DEntry Tiff::read_dentry(char const * b)
 {
 	DEntry e;
-	e.tag = read16();
-	e.type = read16();
-	e.count = read32();
-	e.data = read32();
+	e.tag = to16(b);
+	e.type = to16(b+2);
+	e.count = big ? to64(b+4) : to32(b+4);
+	memcpy(e.raw,b+(big ? 12 : 8),inl());
+	e.data = big ? to64(e.raw) : to32(e.raw);
 	return e;
 }
 
 uint32_t Tiff::to32(DEntry const & e)
 {
-	if (e.type==4) return e.data;
+	if (e.type==4) return to32(e.raw);
+	if (e.type==16) return to64(e.raw);
 	tcheck(e,3);
 	return get16(e);
 }
@@ -69,25 +165,19 @@ uint32_t Tiff::to32(DEntry const & e)
 std::string Tiff::get_str(DEntry const & e)
 {
 	tcheck(e,2);
-	std::vector<char> b(e.count);
-	sp->seekg(e.data);
-	sp->read(b.data(),e.count);
+	if (e.count==0) return std::string();
+	char const * b = e.count<=inl() ? e.raw : fetch(e.data,e.count);
 	if (b[e.count-1]!='\0') warn << "String does not end with '\\0'";
-	return std::string(b.data(),e.count);
+	return std::string(b,e.count);
 }
 
 std::vector<uint16_t> Tiff::get16s(DEntry const & e)
 {
 	std::vector<uint16_t> r;
 	tcheck(e,3);
-	if (e.count<=2) {
-		r.push_back(get16(e));
-		if (e.count==2) r.push_back(next16(e));
-	}
-	else {
-		sp->seekg(e.data);
-		for (unsigned i = 0; i<e.count; i++) r.push_back(read16());
-	}
+	auto b = e.count*2<=inl() ? e.raw : fetch(e.data,size_t(e.count)*2);
+	r.resize(e.count);
+	for (size_t i = 0; i<e.count; i++) r[i] = to16(b+i*2);
 	return r;
 }
 
@@ -95,70 +185,95 @@ std::vector<uint32_t> Tiff::get32s(DEntry const & e)
 {
 	std::vector<uint32_t> r;
 	tcheck(e,4);
-	if (e.count<=1) r.push_back(e.data);
-	else {
-		sp->seekg(e.data);
-		for (unsigned i = 0; i<e.count; i++) r.push_back(read32());
+	auto b = e.count*4<=inl() ? e.raw : fetch(e.data,size_t(e.count)*4);
+	r.resize(e.count);
+	for (size_t i = 0; i<e.count; i++) r[i] = to32(b+i*4);
+	return r;
+}
+
+std::vector<uint64_t> Tiff::get_offsets(DEntry const & e)
+{
+	if (e.type==3) {
+		auto v = get16s(e);
+		return std::vector<uint64_t>(v.begin(),v.end());
 	}
+	if (e.type==4) {
+		auto v = get32s(e);
+		return std::vector<uint64_t>(v.begin(),v.end());
+	}
+	tcheck(e,16);
+	std::vector<uint64_t> r(e.count);
+	auto b = e.count*8<=inl() ? e.raw : fetch(e.data,size_t(e.count)*8);
+	for (size_t i = 0; i<e.count; i++) r[i] = to64(b+i*8);
 	return r;
 }
 
 std::tuple<uint32_t,uint32_t> Tiff::get_ratio(DEntry const & e)
 {
 	tcheck(e,5);
-	sp->seekg(e.data);
-	return {read32(),read32()};
+	auto b = 8<=inl() ? e.raw : fetch(e.data,8);
+	return std::make_tuple(to32(b),to32(b+4));
 }
 
 void Tiff::start()
 {
-	sp->seekg(0);
-	char b[3];
-	sp->read(b,2);
-	b[2] = 0;
-	le = string(b) == "II"; // little endian?
+	auto h = fetch(0,8);
+	string b(h,2);
+	le = b == "II"; // little endian?
 	efix = le^is_little();
-	auto check = read16();
+	auto check = to16(h+2);
 	debug << '[' << b << "]:" << check << '\n';
-	ifd = read32();
+	big = check==43;
+	if (big) {
+		h = fetch(0,16);
+		if (to16(h+4)!=8) error("Unsupported offset size of BigTIFF");
+		ifd = to64(h+8);
+	}
+	else ifd = to32(h+4);
+	nxt = ifd;
 	debug << "IFD at " << ifd << '\n';
 }
 
-uint32_t Tiff::parse_ifd(uint32_t i)
+uint64_t Tiff::parse_ifd(uint64_t i)
 {
-	sp->seekg(i?i:ifd);
-	auto nde = read16();
+	uint64_t o = i?i:ifd;
+	size_t es = big ? 20 : 12; // size of an entry
+	size_t cs = big ? 8 : 2; // size of the entry count
+	uint64_t nde = big ? to64(fetch(o,8)) : to16(fetch(o,2));
 	debug << "# dentry = " << nde << '\n';
-	vector<DEntry> delist;
-	for (unsigned i = 0; i < nde; i ++) {
-		auto e = read_dentry();
-		delist.push_back(e);
-	}
-	uint32_t ni = read32();
-	static map<Tag,function<void(DEntry&)> > ptag = {
-		{Tag_ImageWidth,[this](DEntry& e){image_width = to32(e);}},
-		{Tag_ImageLength,[this](DEntry& e){image_length = to32(e);}},
-		{Tag_BitsPerSample,[this](DEntry& e){bits_per_sample = get16s(e);}},
-		{Tag_Compression,[this](DEntry& e){compression = (Compression)get16(e);}},
-		{Tag_PhotometricInterpretation,[this](DEntry& e){photometric = (Photometric)get16(e);}},
-		{Tag_FillOrder,[this](DEntry& e){fill_order = get16(e);}},
-		{Tag_ImageDescription,[this](DEntry& e){image_description = get_str(e);}},
-		{Tag_StripOffsets,[this](DEntry& e){strip_offsets = get32s(e);}},
-		{Tag_Orientation,[this](DEntry& e){orientation = get16(e);}},
-		{Tag_SamplesPerPixel,[this](DEntry& e){samples_per_pixel = to32(e);}},
-		{Tag_RowsPerStrip,[this](DEntry& e){rows_per_strip = to32(e);}},
-		{Tag_StripByteCounts,[this](DEntry& e){strip_byte_counts = get32s(e);}},
-		{Tag_XResolution,[this](DEntry& e){xresolution = get_ratio(e);}},
-		{Tag_YResolution,[this](DEntry& e){yresolution = get_ratio(e);}},
-		{Tag_PlanarConfiguration,[this](DEntry& e){planar_configuration = get16(e);}},
-		{Tag_ResolutionUnit,[this](DEntry& e){resolution_unit = (Unit)get16(e);}},
-		{Tag_Software,[this](DEntry& e){software = get_str(e);}},
-		{Tag_SampleFormat,[this](DEntry& e){for (auto i:get16s(e)) sample_formats.push_back((SampleFormat)i);}},
-		{Tag_ImageID,[this](DEntry& e){image_id = get_str(e);}}
+	if (nde>0xffff) error("Too many entries in IFD");
+	// fetch the whole directory at once
+	auto b = fetch(o+cs,nde*es+(big ? 8 : 4));
+	vector<DEntry> delist(nde);
+	for (size_t i = 0; i < nde; i ++) delist[i] = read_dentry(b+i*es);
+	uint64_t ni = big ? to64(b+nde*es) : to32(b+nde*es);
+	sample_formats.clear();
+	typedef function<void(Tiff&,DEntry&)> proc_t;
+	static map<Tag,proc_t> const ptag = {
+		{Tag_ImageWidth,[](Tiff& t,DEntry& e){t.image_width = t.to32(e);}},
+		{Tag_ImageLength,[](Tiff& t,DEntry& e){t.image_length = t.to32(e);}},
+		{Tag_BitsPerSample,[](Tiff& t,DEntry& e){t.bits_per_sample = t.get16s(e);}},
+		{Tag_Compression,[](Tiff& t,DEntry& e){t.compression = (Compression)t.get16(e);}},
+		{Tag_PhotometricInterpretation,[](Tiff& t,DEntry& e){t.photometric = (Photometric)t.get16(e);}},
+		{Tag_FillOrder,[](Tiff& t,DEntry& e){t.fill_order = t.get16(e);}},
+		{Tag_ImageDescription,[](Tiff& t,DEntry& e){t.image_description = t.get_str(e);}},
+		{Tag_StripOffsets,[](Tiff& t,DEntry& e){t.strip_offsets = t.get_offsets(e);}},
+		{Tag_Orientation,[](Tiff& t,DEntry& e){t.orientation = t.get16(e);}},
+		{Tag_SamplesPerPixel,[](Tiff& t,DEntry& e){t.samples_per_pixel = t.to32(e);}},
+		{Tag_RowsPerStrip,[](Tiff& t,DEntry& e){t.rows_per_strip = t.to32(e);}},
+		{Tag_StripByteCounts,[](Tiff& t,DEntry& e){t.strip_byte_counts = t.get_offsets(e);}},
+		{Tag_Predictor,[](Tiff& t,DEntry& e){t.predictor = t.get16(e);}},
+		{Tag_XResolution,[](Tiff& t,DEntry& e){t.xresolution = t.get_ratio(e);}},
+		{Tag_YResolution,[](Tiff& t,DEntry& e){t.yresolution = t.get_ratio(e);}},
+		{Tag_PlanarConfiguration,[](Tiff& t,DEntry& e){t.planar_configuration = t.get16(e);}},
+		{Tag_ResolutionUnit,[](Tiff& t,DEntry& e){t.resolution_unit = (Unit)t.get16(e);}},
+		{Tag_Software,[](Tiff& t,DEntry& e){t.software = t.get_str(e);}},
+		{Tag_SampleFormat,[](Tiff& t,DEntry& e){for (auto i:t.get16s(e)) t.sample_formats.push_back((SampleFormat)i);}},
+		{Tag_ImageID,[](Tiff& t,DEntry& e){t.image_id = t.get_str(e);}}
 	};
 	for (auto e: delist) {
 		auto i = ptag.find((Tag)e.tag);
-		if (i!=ptag.end()) i->second(e);
+		if (i!=ptag.end()) i->second(*this,e);
 		else info << "unprocessed tag:" << e.tag << '\n';
 	}
 	debug << " next IFD: " << ni << '\n';
@@ -173,13 +288,25 @@ std::vector<char> Tiff::read_image()
 	size_t isz = image_width*image_length*2;
 	// std::cout << "isz = " << isz << '\n';
 	std::vector<char> b(isz);
+	if (compression!=Cmp_None) {
+		Frame f;
+		f.image_width = image_width;
+		f.image_length = image_length;
+		f.rows_per_strip = rows_per_strip;
+		f.compression = compression;
+		f.predictor = predictor;
+		f.strip_offsets = strip_offsets;
+		f.strip_byte_counts = strip_byte_counts;
+		decode(f,reinterpret_cast<uint16_t *>(b.data()));
+		return b;
+	}
 	size_t ns = (image_length+rows_per_strip-1)/rows_per_strip; // number of strips
 	if (ns!=strip_offsets.size()) error("mismatch number of strip_offsets");
 	size_t tsz = 0;
 	for (unsigned i = 0; i<ns; i++) {
 		size_t z = strip_byte_counts[i];
-		sp->seekg(strip_offsets[i]);
-		sp->read(b.data()+tsz, z);
+		if (tsz+z>isz) error("Image byte size mismatch");
+		memcpy(b.data()+tsz,fetch(strip_offsets[i],z),z);
 		tsz += z;
 	}
 	if (tsz!=isz) error("Image byte size mismatch");
@@ -190,3 +317,300 @@ std::vector<char> Tiff::read_image()
 	}
 	return b;
 }
+
+std::vector<Tiff::Frame> const & Tiff::index()
+{
+	for (size_t k = 0; scan(k); k++);
+	return frames;
+}
+
+size_t Tiff::locate()
+{
+	if (!ifds.empty() || indexed) return frames.size();
+	for (auto & f: frames) ifds.push_back(f.ifd);
+	size_t es = big ? 20 : 12; // size of an entry
+	size_t cs = big ? 8 : 2; // size of the entry count
+	for (uint64_t o = nxt; o; ) {
+		link(o);
+		ifds.push_back(o);
+		uint64_t nde = big ? to64(fetch(o,8)) : to16(fetch(o,2));
+		if (nde>0xffff) error("Too many entries in IFD");
+		o = big ? to64(fetch(o+cs+nde*es,8)) : to32(fetch(o+cs+nde*es,4));
+	}
+	nxt = 0;
+	indexed = true;
+	frames.resize(ifds.size());
+	return ifds.size();
+}
+
+void Tiff::link(uint64_t o)
+{
+	if (!seen.insert(o).second) error("IFD chain loops back to offset "+std::to_string(o));
+}
+
+uint64_t Tiff::read_frame(uint64_t o, Frame & f)
+{
+	f.ifd = o;
+	bits_per_sample.clear();
+	rows_per_strip = 0xffffffff;
+	compression = Cmp_None;
+	predictor = Prd_None;
+	uint64_t n = parse_ifd(o);
+	f.image_width = image_width;
+	f.image_length = image_length;
+	f.bits_per_sample = bits_per_sample.empty() ? 1 : bits_per_sample[0];
+	f.samples_per_pixel = samples_per_pixel;
+	f.sample_format = sample_formats.empty() ? Fmt_Unsigned : sample_formats[0];
+	f.rows_per_strip = rows_per_strip;
+	f.compression = compression;
+	f.predictor = predictor;
+	f.strip_offsets.swap(strip_offsets);
+	f.strip_byte_counts.swap(strip_byte_counts);
+	return n;
+}
+
+Tiff::Frame const * Tiff::scan(size_t k)
+{
+	if (!ifds.empty()) { // located, parse on demand
+		if (k>=ifds.size()) return 0;
+		if (!frames[k].ifd) read_frame(ifds[k],frames[k]);
+		return &frames[k];
+	}
+	while (frames.size()<=k) {
+		if (indexed || !nxt) {
+			indexed = true;
+			return 0;
+		}
+		Frame f;
+		link(nxt);
+		nxt = read_frame(nxt,f);
+		frames.push_back(std::move(f));
+	}
+	return &frames[k];
+}
+
+uint16_t const * Tiff::frame(size_t k, std::vector<uint16_t> & b, bool * swap)
+{
+	auto fp = scan(k);
+	if (!fp) error("Frame "+std::to_string(k)+" beyond the last");
+	auto & f = *fp;
+	if (f.samples_per_pixel!=1 || f.bits_per_sample!=16) {
+		error("Unprocessed samples_per_pixel or bits_per_sample");
+	}
+	size_t sz = size_t(f.image_width)*f.image_length;
+	if (swap) *swap = false;
+	if (f.compression!=Cmp_None) { // swapped by decode for the predictor
+		b.resize(sz);
+		decode(f,b.data());
+		return b.data();
+	}
+	bool fix = efix;
+	if (swap) {
+		*swap = efix;
+		fix = false;
+	}
+	size_t ns = f.strip_offsets.size();
+	if (ns!=f.strip_byte_counts.size()) error("mismatch number of strip_byte_counts");
+	size_t tsz = 0;
+	bool cont = true; // strips contiguous in file?
+	for (size_t i = 0; i<ns; i++) {
+		if (i && f.strip_offsets[i]!=f.strip_offsets[i-1]+f.strip_byte_counts[i-1]) cont = false;
+		tsz += f.strip_byte_counts[i];
+	}
+	if (tsz!=sz*2) error("Image byte size mismatch");
+	if (mp && cont && !fix && ns && f.strip_offsets[0]%2==0) { // view in place
+		return reinterpret_cast<uint16_t const *>(fetch(f.strip_offsets[0],tsz));
+	}
+	b.resize(sz);
+	char * d = reinterpret_cast<char *>(b.data());
+	size_t se = 0; // end of the strips
+	for (size_t i = 0; i<ns; i++) {
+		size_t z = f.strip_byte_counts[i];
+		memcpy(d,fetch(f.strip_offsets[i],z),z);
+		d += z;
+		se = std::max(se,size_t(f.strip_offsets[i])+z);
+	}
+	if (is) release(se);
+	if (fix) for (auto & v: b) v = uint16_t(v<<8|v>>8);
+	return b.data();
+}
+
+std::vector<double> Tiff::values(size_t k)
+{
+	auto fp = scan(k);
+	if (!fp) error("Frame "+std::to_string(k)+" beyond the last");
+	auto & f = *fp;
+	size_t sz = size_t(f.image_width)*f.image_length;
+	if (f.sample_format!=Fmt_IEEEFloat) {
+		std::vector<uint16_t> b;
+		auto v = frame(k,b);
+		return std::vector<double>(v,v+sz);
+	}
+	if (f.samples_per_pixel!=1 || f.bits_per_sample!=32) {
+		error("Unprocessed samples_per_pixel or bits_per_sample");
+	}
+	if (f.compression!=Cmp_None) error("Unprocessed compression of floating point samples");
+	size_t ns = f.strip_offsets.size();
+	if (ns!=f.strip_byte_counts.size()) error("mismatch number of strip_byte_counts");
+	size_t tsz = 0;
+	for (auto z: f.strip_byte_counts) tsz += z;
+	if (tsz!=sz*4) error("Image byte size mismatch");
+	std::vector<uint32_t> b(sz);
+	char * d = reinterpret_cast<char *>(b.data());
+	for (size_t i = 0; i<ns; i++) {
+		size_t z = f.strip_byte_counts[i];
+		memcpy(d,fetch(f.strip_offsets[i],z),z);
+		d += z;
+	}
+	std::vector<double> r(sz);
+	for (size_t i = 0; i<sz; i++) {
+		uint32_t u = b[i];
+		if (efix) u = u>>24|(u>>8&0xff00)|(u<<8&0xff0000)|u<<24;
+		float x;
+		memcpy(&x,&u,4);
+		r[i] = x;
+	}
+	return r;
+}
+
+void Tiff::decode(Frame const & f, uint16_t * d)
+{
+	typedef size_t (* dec_t)(char const *, size_t, char *, size_t);
+	dec_t dec;
+	switch (f.compression) {
+	case Cmp_PackBits: dec = unpack_bits; break;
+	case Cmp_LZW: dec = lzw_decode; break;
+	case Cmp_Deflate: case Cmp_DeflateOld: dec = inflate_strip; break;
+	default: error("Unsupported compression "+std::to_string(f.compression));
+	}
+	if (f.predictor!=Prd_None && f.predictor!=Prd_Horizontal) {
+		error("Unsupported predictor "+std::to_string(f.predictor));
+	}
+	size_t w = f.image_width;
+	size_t h = f.image_length;
+	size_t rps = std::min<size_t>(f.rows_per_strip,h);
+	size_t ns = f.strip_offsets.size();
+	if (!rps || ns!=(h+rps-1)/rps) error("mismatch number of strip_offsets");
+	if (ns!=f.strip_byte_counts.size()) error("mismatch number of strip_byte_counts");
+	// compressed strips, in the mapping or gathered into zb
+	std::vector<char const *> src(ns);
+	if (mp) for (size_t i = 0; i<ns; i++) src[i] = fetch(f.strip_offsets[i],f.strip_byte_counts[i]);
+	else {
+		size_t t = 0;
+		size_t se = 0; // end of the strips
+		for (size_t i = 0; i<ns; i++) {
+			t += f.strip_byte_counts[i];
+			se = std::max(se,size_t(f.strip_offsets[i]+f.strip_byte_counts[i]));
+		}
+		zb.resize(t);
+		t = 0;
+		for (size_t i = 0; i<ns; i++) {
+			size_t z = f.strip_byte_counts[i];
+			memcpy(zb.data()+t,fetch(f.strip_offsets[i],z),z);
+			src[i] = zb.data()+t;
+			t += z;
+		}
+		if (is) release(se);
+	}
+	bool fix = efix;
+	StealPool::task_t task = [&](int, size_t i) {
+		size_t r = std::min(rps,h-i*rps); // rows in this strip
+		uint16_t * o = d+i*rps*w;
+		size_t m = r*w*2;
+		if (dec(src[i],f.strip_byte_counts[i],reinterpret_cast<char *>(o),m)<m) {
+			error("Corrupt compressed strip "+std::to_string(i));
+		}
+		if (fix) for (size_t j = 0; j<r*w; j++) o[j] = uint16_t(o[j]<<8|o[j]>>8);
+		if (f.predictor==Prd_Horizontal) undo_predictor(o,w,r);
+	};
+	if (pool && ns>1) pool->run(ns,task);
+	else for (size_t i = 0; i<ns; i++) task(0,i);
+}
+
+TiffWriter::TiffWriter(std::ostream & os, bool big)
+: os(os), big(big), pos(big ? 16 : 8)
+{
+	char h[16] = {'I','I'};
+	if (!is_little()) h[0] = h[1] = 'M';
+	uint16_t m = big ? 43 : 42;
+	memcpy(h+2,&m,2);
+	if (big) {
+		uint16_t b[] = {8,0}; // offset size
+		uint64_t o = 16; // first IFD follows
+		memcpy(h+4,b,4);
+		memcpy(h+8,&o,8);
+	}
+	else {
+		uint32_t o = 8;
+		memcpy(h+4,&o,4);
+	}
+	os.write(h,pos);
+}
+
+TiffWriter::~TiffWriter()
+{
+	close();
+}
+
+void TiffWriter::add(uint16_t const * v, uint32_t w, uint32_t h)
+{
+	if (pw) put(false);
+	pb.assign(v,v+size_t(w)*h);
+	pw = w;
+	ph = h;
+}
+
+void TiffWriter::close()
+{
+	if (pw) put(true);
+	os.flush();
+}
+
+void TiffWriter::put(bool last)
+{
+	int const ne = 9; // number of entries
+	int const es = big ? 20 : 12; // entry size
+	int const ofs = big ? 8 : 4; // offset size
+	uint64_t d = pos+(big ? 8 : 2)+ne*es+ofs; // offset of the pixels
+	uint64_t sz = pb.size()*2;
+	if (!big && d+sz>0xffffffff) error("TIFF file exceeding 4 GiB, BigTIFF needed");
+	std::vector<char> b(d-pos);
+	char * p = b.data();
+	uint64_t n = ne;
+	if (big) memcpy(p,&n,8);
+	else {
+		uint16_t n16 = ne;
+		memcpy(p,&n16,2);
+	}
+	p += big ? 8 : 2;
+	auto put_n = [](char * p, uint64_t v, int s) { // write v in s bytes
+		uint16_t v16 = v;
+		uint32_t v32 = v;
+		if (s==2) memcpy(p,&v16,2);
+		else if (s==4) memcpy(p,&v32,4);
+		else memcpy(p,&v,8);
+	};
+	auto entry = [&](uint16_t tag, uint16_t type, uint64_t v) {
+		memcpy(p,&tag,2);
+		memcpy(p+2,&type,2);
+		put_n(p+4,1,ofs);
+		put_n(p+4+ofs,v,type==3 ? 2 : type==4 ? 4 : 8);
+		p += es;
+	};
+	uint16_t const ot = big ? 16 : 4; // type of offsets, LONG8 for BigTIFF
+	entry(Tiff::Tag_ImageWidth,4,pw);
+	entry(Tiff::Tag_ImageLength,4,ph);
+	entry(Tiff::Tag_BitsPerSample,3,16);
+	entry(Tiff::Tag_Compression,3,Tiff::Cmp_None);
+	entry(Tiff::Tag_PhotometricInterpretation,3,Tiff::Ptm_BlackIsZero);
+	entry(Tiff::Tag_StripOffsets,ot,d);
+	entry(Tiff::Tag_SamplesPerPixel,3,1);
+	entry(Tiff::Tag_RowsPerStrip,4,ph);
+	entry(Tiff::Tag_StripByteCounts,ot,sz);
+	put_n(p,last ? 0 : d+sz,ofs); // next IFD
+	os.write(b.data(),b.size());
+	os.write(reinterpret_cast<char const *>(pb.data()),sz);
+	if (!os) error("Failed writing TIFF");
+	pos = d+sz;
+	pw = 0;
+}
@@ -1,51 +1,137 @@
 /**\file
    \brief Class for processing TIFF file
    \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Data come from a memory mapping, a seekable stream, or a
+   forward-only stream such as a pipe.  A forward-only stream is read only
+   as far as the IFD or strips requested, keeping what was read since the
+   last released position in memory and moving the oldest part to a
+   temporary file once that exceeds a limit.  Frames must then be taken in
+   order, and each frame releases the data before the end of its strips,
+   which holds for files with the image data of frames in increasing order.
+   Both classic TIFF and BigTIFF, with 64-bit offsets, are read.  Strips
+   may be compressed with PackBits, LZW or Deflate, with or without the
+   horizontal differencing predictor, and are then decoded into the frame
+   buffer, in parallel if a thread pool is given.
  */
 #pragma once
 #include <memory>
+#include <cstdio>
 #include <fstream>
 #include <vector>
 #include <tuple>
 #include <map>
+#include <set>
+
+class StealPool;
 
 /// TIFF file processor
 class Tiff
 {
 	std::shared_ptr<std::ifstream> sp; ///<stream to read data from
+	std::istream * is = 0; ///<forward-only stream to read data from
+	std::vector<char> win; ///<data read from forward-only stream and kept in memory
+	size_t wb = 0; ///<offset of the start of win
+	size_t rel = 0; ///<data before this offset released
+	std::shared_ptr<FILE> spill; ///<temporary file for data moved out of win
+	size_t sb = 0; ///<offset of the start of spill, which ends at wb
+	size_t wlim = size_t(64)<<20; ///<size of win before moving data to spill
+	void stream_to(size_t e); // read forward-only stream up to offset e
+	void release(size_t o); // drop forward-only stream data before offset o
+	StealPool * pool = 0; ///<threads for decoding strips, serial if null
+	std::vector<char> zb; ///<compressed strips gathered from a stream
+	std::shared_ptr<char const> mp; ///<memory mapped file content
+	size_t msz = 0; ///<size of mapped file
 	bool le; ///<little endian?
 	bool efix; ///<need to fix endian?
-	uint32_t ifd; ///<Image file directory offset
-	// read from stream
-	uint16_t read16();
-	uint32_t read32();
+	bool big = false; ///<BigTIFF with 64-bit offsets?
+	uint64_t ifd; ///<Image file directory offset
+	std::vector<char> fb; ///<buffer for data fetched from stream
+	// access n bytes at offset o, from mapping or through fb
+	char const * fetch(uint64_t o, size_t n);
+	// endian corrected values from raw bytes
+	uint16_t to16(char const * b);
+	uint32_t to32(char const * b);
+	uint64_t to64(char const * b);
 public:
 	/// Directory Entry
 	struct DEntry
 	{
 		uint16_t tag; ///<entry name
 		uint16_t type; ///<entry data type
-		uint32_t count; ///<data count
-		uint32_t data; ///<data or offset
+		uint64_t count; ///<data count
+		uint64_t data; ///<data or offset
+		char raw[8]; ///<value field in file byte order, first 4 bytes for classic TIFF
 	};
 private:
-	DEntry read_dentry(); // endian is corrected
-	uint16_t get16(DEntry const & e) {return le?e.data&0xffff:e.data>>16;} // first uint16
-	uint16_t next16(DEntry const & e) {return le?e.data>>16:e.data&0xffff;} // second uint16
+	DEntry read_dentry(char const * b); // endian is corrected
+	size_t inl() const {return big ? 8 : 4;} // bytes of values stored in an entry
+	uint16_t get16(DEntry const & e) {return to16(e.raw);} // first uint16
+	uint16_t next16(DEntry const & e) {return to16(e.raw+2);} // second uint16
 	uint32_t to32(DEntry const & e);
 	std::string get_str(DEntry const & de);
 	std::vector<uint16_t> get16s(DEntry const & e);
-	std::vector<uint32_t> get32s(DEntry const & e);	
+	std::vector<uint32_t> get32s(DEntry const & e);
+	std::vector<uint64_t> get_offsets(DEntry const & e); // SHORT, LONG or LONG8 values
 	std::tuple<uint32_t,uint32_t> get_ratio(DEntry const & e);
 public:
 	/// Construct TIFF processor from an input stream
 	Tiff(std::shared_ptr<std::ifstream> s) : sp(s) {}
+	/// Construct TIFF processor reading a forward-only stream
+	Tiff(std::istream & s ///<stream, e.g. std::cin, positioned at the TIFF header
+	) : is(&s) {}
+	/// Construct TIFF processor on a file
+	/** A regular file is memory mapped, while other files, such as named
+	    pipes, are read as forward-only streams, as is stdin for "-". */
+	Tiff(std::string const & fn ///<name of the file
+	);
+	bool mapped() const {return bool(mp);} ///<\return whether file is memory mapped
+	bool streaming() const {return is!=0;} ///<\return whether input is a forward-only stream
+	bool bigtiff() const {return big;} ///<\return whether file is BigTIFF, valid after start()
+	void set_pool(StealPool * p) {pool = p;} ///<use pool p for decoding strips, null for serial
 	void start(); ///<start with TIFF file header
 	/// Parse image file directory (IFD)
-	uint32_t parse_ifd(
-		uint32_t i = 0 ///<offset position for the IFD
+	uint64_t parse_ifd(
+		uint64_t i = 0 ///<offset position for the IFD
 	); ///<\return offset position for next IFD, 0 if there is no more
 	std::vector<char> read_image(); ///<read image data
+	/// Location and geometry of a single frame
+	struct Frame
+	{
+		uint64_t ifd; ///<offset of the IFD
+		uint32_t image_width; ///<width of image
+		uint32_t image_length; ///<length of image
+		uint16_t bits_per_sample; ///<bits of the (first) sample
+		uint16_t samples_per_pixel; ///<samples per pixel
+		uint16_t sample_format; ///<format of the (first) sample, see SampleFormat
+		uint32_t rows_per_strip; ///<rows per strip
+		uint16_t compression; ///<compression method
+		uint16_t predictor; ///<predictor applied before compression
+		std::vector<uint64_t> strip_offsets; ///<strip offsets
+		std::vector<uint64_t> strip_byte_counts; ///<strip byte counts
+	};
+	/// Walk the IFD chain once to build the frame index
+	std::vector<Frame> const & index(); ///<\return index of all frames
+	/// Walk the IFD chain reading only the links, so that frames can be taken in any order
+	/** Each frame is then parsed only when scanned.  Not for forward-only
+	    streams.  A chain that links back to an IFD already reached is an
+	    error, here as in scan. */
+	size_t locate(); ///<\return number of frames
+	/// Extend the frame index up to frame k
+	Frame const * scan(
+		size_t k ///<frame number
+	); ///<\return frame k in the index, null if the file has fewer frames
+	/// Get 16-bit pixel data of a frame from the index
+	uint16_t const * frame(
+		size_t k, ///<frame number in the index
+		std::vector<uint16_t> & b, ///<buffer used when data cannot be viewed in place
+		bool * swap = 0 ///<[out] if given, byte order is left to the caller and set to whether bytes are to be swapped
+	); ///<\return pointer to the pixels, either into the mapping or into b
+	/// Get pixel values of a frame from the index as numbers
+	/** Takes 16-bit unsigned samples, and 32-bit floating point samples
+	    without compression. */
+	std::vector<double> values(
+		size_t k ///<frame number in the index
+	); ///<\return pixel values in rows
 	/// Directory entry ID tags
 	enum Tag {
 		Tag_ImageWidth = 0x100,
@@ -65,6 +151,7 @@ public:
 		Tag_PlanarConfiguration = 0x11c,
 		Tag_ResolutionUnit = 0x128,
 		Tag_Software = 0x131,
+		Tag_Predictor = 0x13d,
 		Tag_SampleFormat = 0x153,
 		Tag_ImageID = 0x800d
 	};
@@ -72,13 +159,25 @@ public:
 	enum Compression {
 		Cmp_None = 1,
 		Cmp_CCITT = 2,
-		Cmp_PackBits = 32773
+		Cmp_LZW = 5,
+		Cmp_Deflate = 8,
+		Cmp_PackBits = 32773,
+		Cmp_DeflateOld = 32946
 	};
 	/// String names for compression methods
 	std::map<Compression,std::string> const compress_name {
 		{Cmp_None,"None"},
 		{Cmp_CCITT,"CCITT"},
-		{Cmp_PackBits,"PackBits"}
+		{Cmp_LZW,"LZW"},
+		{Cmp_Deflate,"Deflate"},
+		{Cmp_PackBits,"PackBits"},
+		{Cmp_DeflateOld,"Deflate (old code)"}
+	};
+	/// Predictors
+	enum Predictor {
+		Prd_None = 1,
+		Prd_Horizontal = 2,
+		Prd_FloatingPoint = 3
 	};
 	/// Photometric formats
 	enum Photometric {
@@ -129,11 +228,12 @@ public:
 	Photometric photometric; ///<photometric format
 	uint16_t fill_order; ///<fill order
 	std::string image_description; ///<image description
-	std::vector<uint32_t> strip_offsets; ///<strip offsets
+	std::vector<uint64_t> strip_offsets; ///<strip offsets
 	uint16_t orientation; ///<orientation of image
 	uint16_t samples_per_pixel; ///<samples per pixel
 	uint32_t rows_per_strip; ///<rows per strip
-	std::vector<uint32_t> strip_byte_counts; ///<strip byte counots
+	std::vector<uint64_t> strip_byte_counts; ///<strip byte counots
+	uint16_t predictor; ///<predictor
 	std::tuple<uint32_t,uint32_t> xresolution; ///<x resolution
 	std::tuple<uint32_t,uint32_t> yresolution; ///<y resolution
 	uint16_t planar_configuration; ///<planar configuration
@@ -141,4 +241,43 @@ public:
 	std::string software; ///<software used
 	std::vector<SampleFormat> sample_formats; ///<sample formats
 	std::string image_id; ///<image ID
+private:
+	std::vector<Frame> frames; ///<frame index
+	uint64_t nxt = 0; ///<offset of the next IFD to index, 0 at the end
+	std::vector<uint64_t> ifds; ///<offsets of all IFDs once located, with frames parsed on demand
+	std::set<uint64_t> seen; ///<offsets of the IFDs reached through the links, against cycles
+	void link(uint64_t o); // record the IFD at o reached through a link, failing on a cycle
+	uint64_t read_frame(uint64_t o, Frame & f); // parse the IFD at o into f, returning the next offset
+	void decode(Frame const & f, uint16_t * d); // decode compressed strips of f into d
+	bool indexed = false; ///<frame index built?
+};
+
+/// Writer of 16-bit grayscale TIFF or BigTIFF stacks in host byte order
+/** Each frame goes out as an IFD followed by its pixels in a single strip.
+    A frame is held back until the next one arrives or close() is called,
+    so that the last IFD ends the chain without seeking back, and the
+    output can be a pipe. */
+class TiffWriter
+{
+	std::ostream & os; ///<stream written to
+	bool big; ///<writing BigTIFF?
+	uint64_t pos; ///<bytes written so far
+	std::vector<uint16_t> pb; ///<pixels of pending frame
+	uint32_t pw = 0; ///<width of pending frame, 0 if none
+	uint32_t ph = 0; ///<height of pending frame
+	void put(bool last); // write the pending frame
+public:
+	/// Create writer and write the header
+	TiffWriter(
+		std::ostream & os, ///<stream to write to
+		bool big = false ///<write BigTIFF, needed beyond 4 GiB
+	);
+	~TiffWriter(); ///<close if not yet closed
+	/// Append a frame
+	void add(
+		uint16_t const * v, ///<[in] pixels
+		uint32_t w, ///<image width
+		uint32_t h ///<image height
+	);
+	void close(); ///<write the pending frame as the last one
 };
@@ -3,7 +3,9 @@
    \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
  */
 #include "utils.hh"
+#include <cstdint>
 #include <iostream>
+#include <sys/mman.h>
 
 /// Produce an escaped string that, when double quoted, produces the original
 std::string esc_str(std::string const & s)
@@ -57,6 +59,17 @@ std::ostream & warn = msg(MSGL_WARN); ///<stream for warning messages
 /// throw an Error with given message string
 void error(std::string const & m)
 {
-	msg(0) << "Error: " << m << '\n';
 	throw Error(m);
 }
+
+void * huge_alloc(size_t b, void * & raw)
+{
+	size_t const hp = size_t(1)<<21; // huge page size on x86-64
+	size_t a = b>=hp ? hp : 64;
+	raw = ::operator new(b+a);
+	uintptr_t q = (reinterpret_cast<uintptr_t>(raw)+a-1)&~uintptr_t(a-1);
+#ifdef MADV_HUGEPAGE
+	if (a==hp) madvise(reinterpret_cast<void *>(q),b&~(hp-1),MADV_HUGEPAGE);
+#endif
+	return reinterpret_cast<void *>(q);
+}
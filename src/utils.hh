@@ -3,7 +3,10 @@
    \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
  */
 #pragma once
+#include <cstddef>
+#include <new>
 #include <string>
+#include <utility>
 
 /// escape a string in a way that when double quoted, recovers original
 extern std::string esc_str(
@@ -24,4 +27,46 @@ extern std::ostream & msg(int level); ///<message stream with given level
 extern std::ostream & debug; ///<ostream for debugging message
 extern std::ostream & info; ///<ostream informative message
 extern std::ostream & warn; ///<ostream warning message
-void error(std::string const & m); ///<throw error after error message
+void error(std::string const & m); ///<throw Error with message m, to be reported by the caller
+
+/// Allocate memory aligned for huge pages if large, or for cache lines otherwise
+extern void * huge_alloc(
+	size_t b, ///<number of bytes
+	void * & raw ///<[out] block to release with operator delete
+); ///<\return aligned start of b bytes
+
+/// Array of trivial type for large scratch data, aligned for huge pages
+/** The capacity only grows and the contents are not kept when it does,
+    so a buffer reused for data of the same size allocates only once. */
+template<typename T>
+class HugeBuffer
+{
+	void * raw = 0; ///<allocated block
+	T * p = 0; ///<aligned start
+	size_t n = 0; ///<capacity in elements
+public:
+	HugeBuffer() {}
+	HugeBuffer(HugeBuffer const &) = delete;
+	HugeBuffer(HugeBuffer && o) : raw(o.raw), p(o.p), n(o.n) {o.raw = 0; o.p = 0; o.n = 0;}
+	HugeBuffer & operator=(HugeBuffer o) ///<take over o
+	{
+		std::swap(raw,o.raw);
+		std::swap(p,o.p);
+		std::swap(n,o.n);
+		return *this;
+	}
+	~HugeBuffer() {::operator delete(raw);}
+	/// Make room for m elements
+	T * reserve(size_t m) ///<\return start of the array
+	{
+		if (m>n) {
+			::operator delete(raw);
+			raw = 0;
+			p = static_cast<T *>(huge_alloc(m*sizeof(T),raw));
+			n = m;
+		}
+		return p;
+	}
+	T * data() const {return p;} ///<\return start of the array
+	size_t capacity() const {return n;} ///<\return number of elements with room
+};
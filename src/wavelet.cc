@@ -0,0 +1,337 @@
+/**\file
+   \brief Separable convolution for the B-spline wavelet filter
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+ */
+#include "wavelet.hh"
+#include <algorithm>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define WAVELET_X86
+#endif
+
+namespace {
+
+/// Convolve pixels [x0,x1) of a row, skipping taps outside of the row
+template<typename T>
+void row_border(T const * in, T * out, int w, T const * k, int r, int x0, int x1)
+{
+	int n = 2*r+1;
+	for (int x = x0; x<x1; x++) {
+		T s = 0;
+		int r1 = x+r<w ? n : w+r-x;
+		for (int j = x<r ? r-x : 0; j<r1; j++) s += in[x+j-r]*k[j];
+		out[x] = s;
+	}
+}
+
+/// Convolve interior pixels [x0,x1) of a row, all taps inside
+template<typename T>
+inline void row_inner(T const * in, T * out, T const * k, int r, int x0, int x1)
+{
+	int n = 2*r+1;
+	for (int x = x0; x<x1; x++) {
+		T const * p = in+x-r;
+		T s = 0;
+		for (int j = 0; j<n; j++) s += p[j]*k[j];
+		out[x] = s;
+	}
+}
+
+/// Weighted sum of rows j in [j0,j1) for columns [x0,x1) of one output row
+template<typename T>
+inline void col_sum(T const * const * rows, T * out, T const * k, int j0, int j1, int x0, int x1)
+{
+	for (int x = x0; x<x1; x++) {
+		T s = 0;
+		for (int j = j0; j<j1; j++) s += rows[j][x]*k[j];
+		out[x] = s;
+	}
+}
+
+/// Kernels selected for a scalar type
+template<typename T>
+struct Kernels
+{
+	/// Row kernel signature
+	typedef void (row_fn)(T const *, T *, T const *, int, int, int);
+	/// Column kernel signature
+	typedef void (col_fn)(T const * const *, T *, T const *, int, int, int, int);
+	static row_fn * row; ///<selected row kernel
+	static col_fn * col; ///<selected column kernel
+};
+template<typename T> typename Kernels<T>::row_fn * Kernels<T>::row;
+template<typename T> typename Kernels<T>::col_fn * Kernels<T>::col;
+
+template<typename T>
+void row_scalar(T const * in, T * out, T const * k, int r, int x0, int x1)
+{
+	row_inner(in,out,k,r,x0,x1);
+}
+
+template<typename T>
+void col_scalar(T const * const * rows, T * out, T const * k, int j0, int j1, int x0, int x1)
+{
+	col_sum(rows,out,k,j0,j1,x0,x1);
+}
+
+#ifdef WAVELET_X86
+void row_sse2(double const * in, double * out, double const * k, int r, int x0, int x1)
+{
+	int n = 2*r+1;
+	int x = x0;
+	for (; x+2<=x1; x += 2) {
+		double const * p = in+x-r;
+		__m128d s = _mm_setzero_pd();
+		for (int j = 0; j<n; j++) s = _mm_add_pd(s,_mm_mul_pd(_mm_loadu_pd(p+j),_mm_set1_pd(k[j])));
+		_mm_storeu_pd(out+x,s);
+	}
+	row_inner(in,out,k,r,x,x1);
+}
+
+void row_sse2(float const * in, float * out, float const * k, int r, int x0, int x1)
+{
+	int n = 2*r+1;
+	int x = x0;
+	for (; x+4<=x1; x += 4) {
+		float const * p = in+x-r;
+		__m128 s = _mm_setzero_ps();
+		for (int j = 0; j<n; j++) s = _mm_add_ps(s,_mm_mul_ps(_mm_loadu_ps(p+j),_mm_set1_ps(k[j])));
+		_mm_storeu_ps(out+x,s);
+	}
+	row_inner(in,out,k,r,x,x1);
+}
+
+void col_sse2(double const * const * rows, double * out, double const * k, int j0, int j1, int x0, int x1)
+{
+	int x = x0;
+	for (; x+2<=x1; x += 2) {
+		__m128d s = _mm_setzero_pd();
+		for (int j = j0; j<j1; j++) s = _mm_add_pd(s,_mm_mul_pd(_mm_loadu_pd(rows[j]+x),_mm_set1_pd(k[j])));
+		_mm_storeu_pd(out+x,s);
+	}
+	col_sum(rows,out,k,j0,j1,x,x1);
+}
+
+void col_sse2(float const * const * rows, float * out, float const * k, int j0, int j1, int x0, int x1)
+{
+	int x = x0;
+	for (; x+4<=x1; x += 4) {
+		__m128 s = _mm_setzero_ps();
+		for (int j = j0; j<j1; j++) s = _mm_add_ps(s,_mm_mul_ps(_mm_loadu_ps(rows[j]+x),_mm_set1_ps(k[j])));
+		_mm_storeu_ps(out+x,s);
+	}
+	col_sum(rows,out,k,j0,j1,x,x1);
+}
+
+__attribute__((target("avx2")))
+void row_avx2(double const * in, double * out, double const * k, int r, int x0, int x1)
+{
+	int n = 2*r+1;
+	int x = x0;
+	for (; x+4<=x1; x += 4) {
+		double const * p = in+x-r;
+		__m256d s = _mm256_setzero_pd();
+		for (int j = 0; j<n; j++) s = _mm256_add_pd(s,_mm256_mul_pd(_mm256_loadu_pd(p+j),_mm256_set1_pd(k[j])));
+		_mm256_storeu_pd(out+x,s);
+	}
+	row_inner(in,out,k,r,x,x1);
+}
+
+__attribute__((target("avx2")))
+void row_avx2(float const * in, float * out, float const * k, int r, int x0, int x1)
+{
+	int n = 2*r+1;
+	int x = x0;
+	for (; x+8<=x1; x += 8) {
+		float const * p = in+x-r;
+		__m256 s = _mm256_setzero_ps();
+		for (int j = 0; j<n; j++) s = _mm256_add_ps(s,_mm256_mul_ps(_mm256_loadu_ps(p+j),_mm256_set1_ps(k[j])));
+		_mm256_storeu_ps(out+x,s);
+	}
+	row_inner(in,out,k,r,x,x1);
+}
+
+__attribute__((target("avx2")))
+void col_avx2(double const * const * rows, double * out, double const * k, int j0, int j1, int x0, int x1)
+{
+	int x = x0;
+	for (; x+4<=x1; x += 4) {
+		__m256d s = _mm256_setzero_pd();
+		for (int j = j0; j<j1; j++) s = _mm256_add_pd(s,_mm256_mul_pd(_mm256_loadu_pd(rows[j]+x),_mm256_set1_pd(k[j])));
+		_mm256_storeu_pd(out+x,s);
+	}
+	col_sum(rows,out,k,j0,j1,x,x1);
+}
+
+__attribute__((target("avx2")))
+void col_avx2(float const * const * rows, float * out, float const * k, int j0, int j1, int x0, int x1)
+{
+	int x = x0;
+	for (; x+8<=x1; x += 8) {
+		__m256 s = _mm256_setzero_ps();
+		for (int j = j0; j<j1; j++) s = _mm256_add_ps(s,_mm256_mul_ps(_mm256_loadu_ps(rows[j]+x),_mm256_set1_ps(k[j])));
+		_mm256_storeu_ps(out+x,s);
+	}
+	col_sum(rows,out,k,j0,j1,x,x1);
+}
+#endif
+
+/// Highest level supported by the CPU
+SimdLevel simd_supported()
+{
+#ifdef WAVELET_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return Simd_AVX2;
+	return Simd_SSE2;
+#else
+	return Simd_None;
+#endif
+}
+
+/// Select kernels of given level for scalar type T
+template<typename T>
+void select(SimdLevel l)
+{
+	typedef Kernels<T> K;
+	switch (l) {
+#ifdef WAVELET_X86
+	case Simd_AVX2:
+		K::row = row_avx2;
+		K::col = col_avx2;
+		break;
+	case Simd_SSE2:
+		K::row = row_sse2;
+		K::col = col_sse2;
+		break;
+#endif
+	default:
+		K::row = row_scalar<T>;
+		K::col = col_scalar<T>;
+	}
+}
+
+SimdLevel level = set_simd_level(Simd_AVX2); ///<selected level
+
+/// Convolve a single row
+template<typename T>
+void conv_row(T const * in, T * out, int w, T const * k, int r)
+{
+	int xb = std::min(r,w); // end of left border
+	int xe = std::max(w-r,xb); // start of right border
+	row_border(in,out,w,k,r,0,xb);
+	Kernels<T>::row(in,out,k,r,xb,xe);
+	row_border(in,out,w,k,r,xe,w);
+}
+
+/// Row pointers of the column taps, on the stack for kernels of usual size
+template<typename T>
+struct Rows
+{
+	T const * a[32]; ///<pointers for up to 32 taps
+	std::vector<T const *> v; ///<pointers for more taps
+	T const ** p; ///<pointers in use
+	/// Make room for n pointers
+	Rows(int n) : p(a) {
+		if (n>32) {
+			v.resize(n);
+			p = v.data();
+		}
+	}
+};
+
+/// Convolve row y vertically, with input row y' found by row(y')
+template<typename T, typename R>
+void conv_col(R row, T * out, int w, int h, T const * k, int r, int y, T const ** rows)
+{
+	int j0 = y<r ? r-y : 0; // taps above the image are skipped
+	int j1 = y+r<h ? 2*r+1 : h+r-y; // as are those below
+	for (int j = j0; j<j1; j++) rows[j] = row(y+j-r);
+	Kernels<T>::col(rows,out,k,j0,j1,0,w);
+}
+
+} // namespace
+
+SimdLevel set_simd_level(SimdLevel l)
+{
+	l = std::min(l,simd_supported());
+#ifndef WAVELET_X86
+	l = Simd_None;
+#endif
+	select<double>(l);
+	select<float>(l);
+	level = l;
+	return l;
+}
+
+SimdLevel simd_level()
+{
+	return level;
+}
+
+template<typename T>
+void convolve_rows(T const * in, T * out, int w, int h, T const * k, int r)
+{
+	for (int y = 0; y<h; y++) conv_row(in+y*w,out+y*w,w,k,r);
+}
+
+template<typename T>
+void convolve_cols(T const * in, T * out, int w, int h, T const * k, int r)
+{
+	Rows<T> rows(2*r+1); // rows covered by the taps, indexed by tap
+	auto row = [=](int y) {return in+y*w;};
+	for (int y = 0; y<h; y++) conv_col(row,out+y*w,w,h,k,r,y,rows.p);
+}
+
+template<typename T>
+void wavelet_fused(T const * data, T * f2, int w, int h,
+	T const * k1, int r1, T const * k2, int r2, double & f1s, double & f1s2, std::vector<T> * rb)
+{
+	int n1 = 2*r1+1;
+	int n2 = 2*r2+1;
+	// rolling buffers, row y kept at slot y%n
+	std::vector<T> own;
+	if (!rb) rb = &own;
+	if (rb->size()<size_t(n1+2*n2)*w) rb->resize(size_t(n1+2*n2)*w);
+	T * hb1 = rb->data(); // first level, horizontal pass
+	T * vb1 = hb1+n1*w; // first level V1
+	T * hb2 = vb1+n2*w; // second level, horizontal pass
+	auto h1 = [&](int y) {return hb1+y%n1*w;};
+	auto v1 = [&](int y) {return vb1+y%n2*w;};
+	auto h2 = [&](int y) {return hb2+y%n2*w;};
+	Rows<T> rows(std::max(n1,n2));
+	f1s = 0;
+	f1s2 = 0;
+	for (int t = 0; t<h+r1+r2; t++) {
+		if (t<h) conv_row(data+t*w,h1(t),w,k1,r1);
+		int yv = t-r1; // row of V1 completed
+		if (yv>=0 && yv<h) {
+			T * v = v1(yv);
+			conv_col(h1,v,w,h,k1,r1,yv,rows.p);
+			T const * d = data+yv*w;
+			for (int x = 0; x<w; x++) {
+				double f1 = d[x]-v[x];
+				f1s += f1;
+				f1s2 += f1*f1;
+			}
+			conv_row(v,h2(yv),w,k2,r2);
+		}
+		int yf = yv-r2; // row of F2 completed
+		if (yf>=0 && yf<h) {
+			T * f = f2+yf*w;
+			conv_col(h2,f,w,h,k2,r2,yf,rows.p);
+			T const * v = v1(yf);
+			for (int x = 0; x<w; x++) f[x] = v[x]-f[x];
+		}
+	}
+}
+
+///@{
+/// Instantiations for the supported scalar types
+template void convolve_rows(float const *, float *, int, int, float const *, int);
+template void convolve_rows(double const *, double *, int, int, double const *, int);
+template void convolve_cols(float const *, float *, int, int, float const *, int);
+template void convolve_cols(double const *, double *, int, int, double const *, int);
+template void wavelet_fused(float const *, float *, int, int, float const *, int, float const *, int, double &, double &, std::vector<float> *);
+template void wavelet_fused(double const *, double *, int, int, double const *, int, double const *, int, double &, double &, std::vector<double> *);
+///@}
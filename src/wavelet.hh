@@ -0,0 +1,71 @@
+/**\file
+   \brief Separable convolution for the B-spline wavelet filter
+   \author Chun-Chung Chen &lt;cjj@u.washington.edu&gt;
+   \details Kernels are symmetric with 2r+1 taps and the image is padded
+   with zeros, i.e. taps falling outside of the image are skipped.  Border
+   pixels go through a scalar path with clamped tap range, while the
+   interior runs through SIMD kernels selected at runtime.  Every pixel sums
+   its taps in the same order on all paths, so the results do not depend
+   on the instruction set used.  All functions are instantiated for float
+   and double.
+*/
+#pragma once
+#include <vector>
+
+/// Instruction sets for the convolution kernels
+enum SimdLevel {
+	Simd_None = 0, ///<plain scalar code
+	Simd_SSE2 = 1, ///<128-bit vectors
+	Simd_AVX2 = 2 ///<256-bit vectors
+};
+
+/// Select instruction set for the kernels
+extern SimdLevel set_simd_level(
+	SimdLevel l ///<requested level, lowered to what the CPU supports
+); ///<\return level actually selected
+extern SimdLevel simd_level(); ///<\return currently selected level
+
+/// Horizontal pass of the convolution
+template<typename T>
+void convolve_rows(
+	T const * in, ///<[in] input image
+	T * out, ///<[out] output image
+	int w, ///<image width
+	int h, ///<image height
+	T const * k, ///<kernel with 2r+1 taps
+	int r ///<kernel radius
+);
+
+/// Vertical pass of the convolution
+template<typename T>
+void convolve_cols(
+	T const * in, ///<[in] input image
+	T * out, ///<[out] output image
+	int w, ///<image width
+	int h, ///<image height
+	T const * k, ///<kernel with 2r+1 taps
+	int r ///<kernel radius
+);
+
+/// Second level of the wavelet filter with first level statistics, in one sweep
+/**
+   Computes F2 = V1-V2 with V1 = K1*data and V2 = K2*V1, together with the
+   sum and the sum of squares of F1 = data-V1.  Intermediate results are
+   kept only in rolling buffers of 2r+1 rows for each pass, so that only
+   the input and F2 are full frames.  Results are identical to those of
+   the separate passes.
+*/
+template<typename T>
+void wavelet_fused(
+	T const * data, ///<[in] input image
+	T * f2, ///<[out] second wavelet level
+	int w, ///<image width
+	int h, ///<image height
+	T const * k1, ///<kernel for the first level, 2r1+1 taps
+	int r1, ///<radius of the first kernel
+	T const * k2, ///<kernel for the second level, 2r2+1 taps
+	int r2, ///<radius of the second kernel
+	double & f1s, ///<[out] sum of F1, accumulated in double
+	double & f1s2, ///<[out] sum of F1 squared, accumulated in double
+	std::vector<T> * rb = 0 ///<rolling buffers kept across calls, if not null
+);